@@ -0,0 +1,62 @@
+/**
+ * @file	ADC_Encode.h
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#ifndef ADC_ENCODE_H_
+#define ADC_ENCODE_H_
+
+#include <stdint.h>	// No hardware dependencies, the encoders are tested on the host
+
+#define ADC_ENCODING_PACKED		0	// 10-bit samples
+#define ADC_ENCODING_DELTA		1	// 4-bit deltas from the previous sweep, 10-bit escapes
+
+#define ADC_DELTA_ESCAPE		0x8	// Delta nibble followed by a raw 10-bit sample
+#define ADC_DELTA_MAX_BITS		14	// Escape + raw sample
+
+typedef struct {
+	uint8_t *ptr;
+	uint32_t acc;
+	uint8_t bits;
+} ADC_BitWriter;
+
+void ADC_FlushBits(ADC_BitWriter *w);
+
+/*
+ * Encoders take samples from..from+count-1 of a ring of mask+1 samples and
+ * return the number of samples encoded. A delta block may write up to a sweep
+ * past maxBytes before it is dropped, w must have room for it.
+ */
+uint32_t ADC_EncodePacked(const uint16_t *ring, uint32_t mask, uint32_t from, uint32_t count, ADC_BitWriter *w);
+uint32_t ADC_EncodeDelta(const uint16_t *ring, uint32_t mask, uint32_t from, uint32_t count, uint8_t channels,
+		uint32_t maxBytes, ADC_BitWriter *w);
+
+#endif /* ADC_ENCODE_H_ */
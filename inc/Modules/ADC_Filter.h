@@ -0,0 +1,68 @@
+/**
+ * @file	ADC_Filter.h
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#ifndef ADC_FILTER_H_
+#define ADC_FILTER_H_
+
+#include <stdint.h>	// No hardware dependencies, the filters are tested on the host
+
+/*
+ * analogRead filters, fixed point only. Every read starts from a clean state,
+ * except IIR, which takes one conversion per read and keeps its output.
+ */
+#define ADC_FILTER_NONE			0
+#define ADC_FILTER_OVERSAMPLE	1	// Sum of 4^n conversions >> n, n extra bits
+#define ADC_FILTER_AVERAGE		2	// Mean of 2^n conversions
+#define ADC_FILTER_IIR			3	// y += (x - y) / 2^n
+#define ADC_FILTER_CIC			4	// Order m CIC, decimation by 2^n
+
+#define ADC_CIC_MAX_ORDER		3
+#define ADC_IIR_FRACTION_BITS	6
+
+typedef struct {
+	uint8_t type;			// ADC_FILTER_x
+	uint8_t shift;			// n
+	uint8_t order;			// m (CIC)
+	uint8_t primed;			// IIR has an output
+	int32_t state;			// IIR output << ADC_IIR_FRACTION_BITS
+	uint32_t acc;			// Sum or the latest CIC output
+	uint32_t integrator[ADC_CIC_MAX_ORDER];	// Wrap-around is fine for CIC
+	uint32_t comb[ADC_CIC_MAX_ORDER];
+} ADC_Filter;
+
+uint32_t ADC_FilterSamples(ADC_Filter *f);	// Conversions needed for a single result
+void ADC_FilterReset(ADC_Filter *f);
+void ADC_FilterPut(ADC_Filter *f, uint16_t x, uint32_t index);	// index - conversion number since the reset
+uint16_t ADC_FilterResult(ADC_Filter *f);
+
+#endif /* ADC_FILTER_H_ */
@@ -35,6 +35,22 @@
 
 #include "main.h"
 
+void ADC_IRQHandler(void);
+
+void ADC_Process(void);	// Sends the streamed samples, called from the main loop
+
 SFPResult lpc_analogRead(SFPFunction *msg);
 
+SFPResult lpc_adc_stream_begin(SFPFunction *msg);
+
+SFPResult lpc_adc_timed_begin(SFPFunction *msg);
+
+SFPResult lpc_adc_stream_end(SFPFunction *msg);
+
+SFPResult lpc_adc_config(SFPFunction *msg);
+
+SFPResult lpc_adc_filter(SFPFunction *msg);
+
+SFPResult lpc_adc_watch(SFPFunction *msg);
+
 #endif /* LPC_ADC_H_ */
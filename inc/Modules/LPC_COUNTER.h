@@ -0,0 +1,51 @@
+/**
+ * @file	LPC_COUNTER.h
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#ifndef LPC_COUNTER_H_
+#define LPC_COUNTER_H_
+
+#include "main.h"
+
+#define COUNTER_COUNT		4
+#define COUNTER_HW_PIN		0	// PIO0_20 - CT16B1_CAP0, counted by the timer hardware
+
+void TIMER16_1_IRQHandler(void);
+
+void COUNTER_Process(void);	// Gate windows and periodic reports, called from the main loop
+
+SFPResult lpc_counter_begin(SFPFunction *msg);
+
+SFPResult lpc_counter_read(SFPFunction *msg);
+
+SFPResult lpc_counter_end(SFPFunction *msg);
+
+#endif /* LPC_COUNTER_H_ */
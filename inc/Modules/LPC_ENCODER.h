@@ -0,0 +1,49 @@
+/**
+ * @file	LPC_ENCODER.h
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#ifndef LPC_ENCODER_H_
+#define LPC_ENCODER_H_
+
+#include "main.h"
+
+#define ENCODER_COUNT			4	// Each encoder takes two pin interrupt channels
+#define ENCODER_VELOCITY_PERIOD	20	// Velocity estimation window in milliseconds
+
+void ENCODER_Process(void);	// Velocity estimation and change reports, called from the main loop
+
+SFPResult lpc_encoder_begin(SFPFunction *msg);
+
+SFPResult lpc_encoder_read(SFPFunction *msg);
+
+SFPResult lpc_encoder_end(SFPFunction *msg);
+
+#endif /* LPC_ENCODER_H_ */
@@ -37,9 +37,50 @@
 
 #define LPC_PIN_COUNT	37
 #define LPC_INTERRUPT_COUNT 8
+#define LPC_PULSE_MAX_COUNT	16	// Pulses measured by a single pulseIn call
+#define LPC_GROUP_INTERRUPT_COUNT	2
+
+#define GPIO_EVENT_SOURCE_COUNT		16	// interrupt message sources
+#define GPIO_EVENT_SOURCE_ADC		8	// ADC watch of channel n is source 8+n
+
+#define GPIO_DEBOUNCE_LEADING	0	// Report the first edge, coalesce edges for the period after it
+#define GPIO_DEBOUNCE_TRAILING	1	// Report the last edge once there were no edges for the period
+#define GPIO_DEBOUNCE_STABLE	2	// Report a level change once the pin was stable for the period
+
+extern uint8_t const LPC_PIN_IDS[];
+extern volatile uint32_t * const LPC_PIN_REGISTERS[];
+
+typedef void (*GPIO_InterruptCallback)(uint8_t intID);
+
+typedef struct {
+	uint8_t source;		// Interrupt ID
+	uint8_t event;		// Interrupt event (attachInterrupt mode)
+	uint16_t count;		// Number of coalesced edges
+	uint32_t data;		// Values of all interrupt channel pins
+	time_us_t time;		// Time_getAlarmTime() of the event
+} GPIO_Event;
 
 inline void GPIO_EnableInterrupt(uint8_t intID);
 
+/*
+ * Pin interrupt channels are shared by attachInterrupt and on-device functions.
+ * GPIO_AllocInterrupt returns a free channel ID or -1, GPIO_ConfigInterrupt
+ * takes attachInterrupt modes (0-4) and enables the channel.
+ */
+int8_t GPIO_AllocInterrupt(GPIO_InterruptCallback handler);
+void GPIO_ConfigInterrupt(uint8_t intID, uint8_t pin, uint8_t mode);
+void GPIO_FreeInterrupt(uint8_t intID);
+
+/*
+ * Lock-free single producer queue: events may only be pushed from ISRs running
+ * at the pin interrupt priority (3), or with interrupts disabled, so producers
+ * never preempt each other.
+ */
+uint8_t GPIO_PushEvent(uint8_t source, uint8_t event, uint32_t data);
+void GPIO_SetEventType(uint8_t source, SFPFunctionType type);	// Message type for the events of a non-pin source
+
+void GPIO_Process(void);	// Background tasks, called from the main loop
+
 void FLEX_INT0_IRQHandler(void);
 void FLEX_INT1_IRQHandler(void);
 void FLEX_INT2_IRQHandler(void);
@@ -49,6 +90,9 @@ void FLEX_INT5_IRQHandler(void);
 void FLEX_INT6_IRQHandler(void);
 void FLEX_INT7_IRQHandler(void);
 
+void GINT0_IRQHandler(void);
+void GINT1_IRQHandler(void);
+
 void lpc_config_gpioInit(void);
 
 SFPResult lpc_config_setPrimary(SFPFunction *msg);
@@ -65,7 +109,15 @@ SFPResult lpc_attachInterrupt(SFPFunction *msg);
 
 SFPResult lpc_detachInterrupt(SFPFunction *msg);
 
+SFPResult lpc_attachGroupInterrupt(SFPFunction *msg);
+
+SFPResult lpc_detachGroupInterrupt(SFPFunction *msg);
+
 SFPResult lpc_pulseIn(SFPFunction *msg);
 
+SFPResult lpc_shiftOut(SFPFunction *msg);
+
+SFPResult lpc_shiftIn(SFPFunction *msg);
+
 
 #endif /* LPC_GPIO_H_ */
@@ -35,10 +35,35 @@
 
 #include "main.h"
 
+#define I2C_RATE_STANDARD	100000
+#define I2C_RATE_FAST		400000
+#define I2C_RATE_FAST_PLUS	1000000
+
+#define I2C_TIMEOUT_DEFAULT	100000	// us
+
+/*
+ * i2c_trans errors. NACK and arbitration errors are the I2C status codes.
+ */
+#define I2C_ERR_NONE				0
+#define I2C_ERR_PROTOCOL			1		// Unexpected bus state, or I2C not started
+#define I2C_ERR_ADDRESS_NACK		0x20	// SLA+W not acknowledged
+#define I2C_ERR_DATA_NACK			0x30	// Written data not acknowledged
+#define I2C_ERR_ARBITRATION			0x38	// Arbitration lost
+#define I2C_ERR_READ_ADDRESS_NACK	0x48	// SLA+R not acknowledged
+#define I2C_ERR_READ_NACK			0x58	// Read ended early
+#define I2C_ERR_TIMEOUT				0x100	// Transaction timed out, the bus was recovered
+#define I2C_ERR_BUS_STUCK			0x101	// The bus is still held after recovery
 
 void I2C_IRQHandler(void);
+
+/*
+ * Blocking write-then-read for on-device users. Returns I2C_ERR_x.
+ */
+uint32_t I2C_Transfer(uint8_t address, uint8_t *write, uint32_t writeSize, uint8_t *read, uint32_t readSize, uint32_t *readCount);
+
 SFPResult lpc_i2c_begin(SFPFunction *msg);
 SFPResult lpc_i2c_trans(SFPFunction *msg);
+SFPResult lpc_i2c_batch(SFPFunction *msg);
 SFPResult lpc_i2c_end(SFPFunction *msg);
 
 #endif /* LPC_I2C_H_ */
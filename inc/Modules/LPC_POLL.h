@@ -0,0 +1,53 @@
+/**
+ * @file	LPC_POLL.h
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#ifndef LPC_POLL_H_
+#define LPC_POLL_H_
+
+#include "main.h"
+
+#define POLL_COUNT			4
+#define POLL_READ_MAX		32	// Bytes read by a single job
+#define POLL_PERIOD_MIN		500	// us
+
+#define POLL_BUS_I2C		0
+#define POLL_BUS_SPI0		1
+#define POLL_BUS_SPI1		2
+
+void POLL_Process(void);	// Runs due jobs, called from the main loop
+
+SFPResult lpc_poll_begin(SFPFunction *msg);
+
+SFPResult lpc_poll_end(SFPFunction *msg);
+
+#endif /* LPC_POLL_H_ */
@@ -35,12 +35,35 @@
 
 #include "main.h"
 
+#define SPI_PORT_COUNT	2	// SSP0, SSP1
+
+void SSP0_IRQHandler(void);
+void SSP1_IRQHandler(void);
+
+void SPI_Process(void);	// Reports finished background transfers, called from the main loop
+
+#define SPI_CS_NONE			0xFF	// No chip select pin
+#define SPI_CS_ACTIVE_HIGH	BIT0
+
+/*
+ * Blocking write-then-read under csPin for on-device users. Sizes are in bytes
+ * of packed frames. Returns 0, or 1 if the port isn't started or is busy.
+ */
+uint8_t SPI_Transfer(uint8_t port, uint8_t csPin, uint8_t csActiveHigh,
+		const uint8_t *write, uint32_t writeSize, uint8_t *read, uint32_t readSize);
+
 SFPResult lpc_spi0_begin(SFPFunction *msg);
 SFPResult lpc_spi0_trans(SFPFunction *msg);
+SFPResult lpc_spi0_xfer(SFPFunction *msg);
+SFPResult lpc_spi0_slave(SFPFunction *msg);
+SFPResult lpc_spi0_start(SFPFunction *msg);
 SFPResult lpc_spi0_end(SFPFunction *msg);
 
 SFPResult lpc_spi1_begin(SFPFunction *msg);
 SFPResult lpc_spi1_trans(SFPFunction *msg);
+SFPResult lpc_spi1_xfer(SFPFunction *msg);
+SFPResult lpc_spi1_slave(SFPFunction *msg);
+SFPResult lpc_spi1_start(SFPFunction *msg);
 SFPResult lpc_spi1_end(SFPFunction *msg);
 
 #endif /* LPC_SPI_H_ */
@@ -0,0 +1,51 @@
+/**
+ * @file	LPC_WAVE.h
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#ifndef LPC_WAVE_H_
+#define LPC_WAVE_H_
+
+#include "main.h"
+
+#define WAVE_MAX_PINS	32
+#define WAVE_STEP_SIZE	12	// Step on the wire: mask, values and delay as little-endian uint32
+
+SFPResult lpc_wave_begin(SFPFunction *msg);
+
+SFPResult lpc_wave_load(SFPFunction *msg);
+
+SFPResult lpc_wave_start(SFPFunction *msg);
+
+SFPResult lpc_wave_stop(SFPFunction *msg);
+
+SFPResult lpc_wave_end(SFPFunction *msg);
+
+#endif /* LPC_WAVE_H_ */
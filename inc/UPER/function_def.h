@@ -49,18 +49,34 @@
 #define UPER_FID_PULSEIN			9
 
 #define UPER_FID_ANALOGREAD			10
+#define UPER_FID_ADCSTREAMBEGIN		11
+#define UPER_FID_ADCSTREAM			12
+#define UPER_FID_ADCSTREAMEND		13
+#define UPER_FID_ADCCONFIG			14
+#define UPER_FID_ADCTIMEDBEGIN		15
+#define UPER_FID_ADCFILTER			16
+#define UPER_FID_ADCWATCH			17
 
 #define UPER_FID_SPI0BEGIN			20
 #define UPER_FID_SPI0TRANS			21
 #define UPER_FID_SPI0END			22
+#define UPER_FID_SPI0START			23
+#define UPER_FID_SPI0DONE			24
+#define UPER_FID_SPI0XFER			25
+#define UPER_FID_SPI0SLAVE			26
 
 #define UPER_FID_SPI1BEGIN			30
 #define UPER_FID_SPI1TRANS			31
 #define UPER_FID_SPI1END			32
+#define UPER_FID_SPI1START			33
+#define UPER_FID_SPI1DONE			34
+#define UPER_FID_SPI1XFER			35
+#define UPER_FID_SPI1SLAVE			36
 
 #define UPER_FID_I2CBEGIN			40
 #define UPER_FID_I2CTRANS			41
 #define UPER_FID_I2CEND				42
+#define UPER_FID_I2CBATCH			43
 
 #define UPER_FID_PWM0BEGIN			50
 #define UPER_FID_PWM0SET			51
@@ -70,6 +86,30 @@
 #define UPER_FID_PWM1SET			61
 #define UPER_FID_PWM1END			62
 
+#define UPER_FID_WAVEBEGIN			70
+#define UPER_FID_WAVELOAD			71
+#define UPER_FID_WAVESTART			72
+#define UPER_FID_WAVESTOP			73
+#define UPER_FID_WAVEEND			74
+
+#define UPER_FID_COUNTERBEGIN		80
+#define UPER_FID_COUNTERREAD		81
+#define UPER_FID_COUNTEREND			82
+
+#define UPER_FID_ENCODERBEGIN		90
+#define UPER_FID_ENCODERREAD		91
+#define UPER_FID_ENCODEREND			92
+
+#define UPER_FID_ATTACHGROUPINT		110
+#define UPER_FID_DETACHGROUPINT		111
+#define UPER_FID_GROUPINTERRUPT		112
+#define UPER_FID_SHIFTOUT			113
+#define UPER_FID_SHIFTIN			114
+
+#define UPER_FID_POLLBEGIN			120
+#define UPER_FID_POLL				121
+#define UPER_FID_POLLEND			122
+
 #define UPER_FID_RESTART			251
 
 #define UPER_FID_GETDEVICEINFO		255
@@ -89,18 +129,34 @@
 #define UPER_FNAME_PULSEIN			"pulseIn"
 
 #define UPER_FNAME_ANALOGREAD		"analogRead"
+#define UPER_FNAME_ADCSTREAMBEGIN	"adc_stream_begin"
+#define UPER_FNAME_ADCSTREAM		"adc_stream"
+#define UPER_FNAME_ADCSTREAMEND		"adc_stream_end"
+#define UPER_FNAME_ADCCONFIG		"adc_config"
+#define UPER_FNAME_ADCTIMEDBEGIN	"adc_timed_begin"
+#define UPER_FNAME_ADCFILTER		"adc_filter"
+#define UPER_FNAME_ADCWATCH			"adc_watch"
 
 #define UPER_FNAME_SPI0BEGIN		"spi0_begin"
 #define UPER_FNAME_SPI0TRANS		"spi0_trans"
 #define UPER_FNAME_SPI0END			"spi0_end"
+#define UPER_FNAME_SPI0START		"spi0_start"
+#define UPER_FNAME_SPI0DONE			"spi0_done"
+#define UPER_FNAME_SPI0XFER			"spi0_xfer"
+#define UPER_FNAME_SPI0SLAVE		"spi0_slave"
 
 #define UPER_FNAME_SPI1BEGIN		"spi1_begin"
 #define UPER_FNAME_SPI1TRANS		"spi1_trans"
 #define UPER_FNAME_SPI1END			"spi1_end"
+#define UPER_FNAME_SPI1START		"spi1_start"
+#define UPER_FNAME_SPI1DONE			"spi1_done"
+#define UPER_FNAME_SPI1XFER			"spi1_xfer"
+#define UPER_FNAME_SPI1SLAVE		"spi1_slave"
 
 #define UPER_FNAME_I2CBEGIN			"i2c_begin"
 #define UPER_FNAME_I2CTRANS			"i2c_trans"
 #define UPER_FNAME_I2CEND			"i2c_end"
+#define UPER_FNAME_I2CBATCH			"i2c_batch"
 
 #define UPER_FNAME_PWM0BEGIN		"pwm0_begin"
 #define UPER_FNAME_PWM0SET			"pwm0_set"
@@ -110,6 +166,30 @@
 #define UPER_FNAME_PWM1SET			"pwm1_set"
 #define UPER_FNAME_PWM1END			"pwm1_end"
 
+#define UPER_FNAME_WAVEBEGIN		"wave_begin"
+#define UPER_FNAME_WAVELOAD			"wave_load"
+#define UPER_FNAME_WAVESTART		"wave_start"
+#define UPER_FNAME_WAVESTOP			"wave_stop"
+#define UPER_FNAME_WAVEEND			"wave_end"
+
+#define UPER_FNAME_COUNTERBEGIN		"counter_begin"
+#define UPER_FNAME_COUNTERREAD		"counter_read"
+#define UPER_FNAME_COUNTEREND		"counter_end"
+
+#define UPER_FNAME_ENCODERBEGIN		"encoder_begin"
+#define UPER_FNAME_ENCODERREAD		"encoder_read"
+#define UPER_FNAME_ENCODEREND		"encoder_end"
+
+#define UPER_FNAME_ATTACHGROUPINT	"attachGroupInterrupt"
+#define UPER_FNAME_DETACHGROUPINT	"detachGroupInterrupt"
+#define UPER_FNAME_GROUPINTERRUPT	"groupInterrupt"
+#define UPER_FNAME_SHIFTOUT			"shiftOut"
+#define UPER_FNAME_SHIFTIN			"shiftIn"
+
+#define UPER_FNAME_POLLBEGIN		"poll_begin"
+#define UPER_FNAME_POLL				"poll"
+#define UPER_FNAME_POLLEND			"poll_end"
+
 #define UPER_FNAME_RESTART			"restart"
 
 #define UPER_FNAME_GETDEVICEINFO	"GetDeviceInfo"
@@ -39,6 +39,11 @@ typedef uint32_t	time_t;
 typedef uint32_t	time_us_t;
 typedef void (*TimerCallback)(void*);
 
+#define TIME_ALARM_COUNT	4	// CT32B1 match channels MR0-MR3
+
+#define TIME_ALARM_WAVE		0	// Waveform playback
+#define TIME_ALARM_DEBOUNCE	1	// Pin interrupt debounce
+
 void Time_init(void);
 
 time_t Time_getSystemTime(void);
@@ -51,4 +56,12 @@ void Time_delay(uint32_t time); // Delay a number of milliseconds
 void Time_setCountdown(uint32_t time);
 uint8_t Time_isCountdownRunning(void);
 
+/*
+ * Microsecond alarms (CT32B1 running free at 1MHz). Alarm times are absolute
+ * Time_getAlarmTime() values, callbacks are one-shot and run in the timer ISR.
+ */
+time_us_t Time_getAlarmTime(void);
+void Time_setAlarm(uint8_t alarm, time_us_t time, TimerCallback callback, void *param);
+void Time_clearAlarm(uint8_t alarm);
+
 #endif /* TIME_H_ */
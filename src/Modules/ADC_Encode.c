@@ -0,0 +1,111 @@
+/**
+ * @file	ADC_Encode.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include "Modules/ADC_Encode.h"
+
+static inline void ADC_PutBits(ADC_BitWriter *w, uint32_t value, uint8_t bits) {	// LSB first
+	w->acc |= value << w->bits;
+	w->bits += bits;
+
+	while (w->bits >= 8) {
+		*w->ptr++ = w->acc;
+		w->acc >>= 8;
+		w->bits -= 8;
+	}
+}
+
+void ADC_FlushBits(ADC_BitWriter *w) {
+	if (w->bits) {
+		*w->ptr++ = w->acc;
+		w->acc = 0;
+		w->bits = 0;
+	}
+}
+
+#define ADC_SAMPLE(pos)	ring[(pos) & mask]
+
+/*
+ * Packed: 10-bit samples, 4 samples take 5 bytes
+ */
+uint32_t ADC_EncodePacked(const uint16_t *ring, uint32_t mask, uint32_t from, uint32_t count, ADC_BitWriter *w) {
+	uint32_t i;
+
+	for (i=0; i<count; i++)
+		ADC_PutBits(w, ADC_SAMPLE(from + i), 10);
+
+	return count;
+}
+
+/*
+ * Delta: the first sweep is raw, the rest are 4-bit signed deltas from the same
+ * channel in the previous sweep. Deltas out of -7..7 are an escape nibble and
+ * a raw sample. Encodes whole sweeps while they fit in maxBytes, a sweep that
+ * doesn't is written and then dropped.
+ */
+uint32_t ADC_EncodeDelta(const uint16_t *ring, uint32_t mask, uint32_t from, uint32_t count, uint8_t channels,
+		uint32_t maxBytes, ADC_BitWriter *w) {
+	ADC_BitWriter sweepStart = *w;
+	uint32_t i, sweep = 0, used = 0;
+
+	for (i=0; i<count; i++) {
+		if (i % channels == 0) {	// Everything before fits
+			sweepStart = *w;
+			sweep = i;
+		}
+
+		uint16_t x = ADC_SAMPLE(from + i);
+
+		if (i < channels) {
+			ADC_PutBits(w, x, 10);
+			used += 10;
+			continue;
+		}
+
+		int32_t delta = (int32_t)x - ADC_SAMPLE(from + i - channels);
+		if (delta >= -7 && delta <= 7) {
+			ADC_PutBits(w, delta & 0xF, 4);
+			used += 4;
+		} else {
+			ADC_PutBits(w, ADC_DELTA_ESCAPE, 4);
+			ADC_PutBits(w, x, 10);
+			used += ADC_DELTA_MAX_BITS;
+		}
+
+		if (used > maxBytes*8) {	// Roll back to the end of the previous sweep
+			*w = sweepStart;
+			return sweep;
+		}
+	}
+
+	return i;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file	ADC_Filter.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include "Modules/ADC_Filter.h"
+
+uint32_t ADC_FilterSamples(ADC_Filter *f) {
+	switch (f->type) {
+		case ADC_FILTER_OVERSAMPLE:	return 1 << (2 * f->shift);
+		case ADC_FILTER_AVERAGE:	return 1 << f->shift;
+		case ADC_FILTER_CIC:		return f->order << f->shift;
+		default:					return 1;
+	}
+}
+
+void ADC_FilterReset(ADC_Filter *f) {
+	uint8_t i;
+
+	f->acc = 0;
+	for (i=0; i<ADC_CIC_MAX_ORDER; i++) {
+		f->integrator[i] = 0;
+		f->comb[i] = 0;
+	}
+}
+
+void ADC_FilterPut(ADC_Filter *f, uint16_t x, uint32_t index) {
+	switch (f->type) {
+		case ADC_FILTER_IIR: {
+			if (!f->primed) {
+				f->state = (int32_t)x << ADC_IIR_FRACTION_BITS;
+				f->primed = 1;
+			} else {
+				f->state += (((int32_t)x << ADC_IIR_FRACTION_BITS) - f->state) >> f->shift;
+			}
+			break;
+		}
+		case ADC_FILTER_CIC: {
+			uint8_t i;
+			uint32_t v = x;
+
+			for (i=0; i<f->order; i++) {	// Integrators run at the input rate
+				f->integrator[i] += v;
+				v = f->integrator[i];
+			}
+
+			if (((index + 1) & ((1 << f->shift) - 1)) == 0) {	// Combs run at the decimated rate
+				for (i=0; i<f->order; i++) {
+					uint32_t prev = f->comb[i];
+					f->comb[i] = v;
+					v -= prev;
+				}
+				f->acc = v;
+			}
+			break;
+		}
+		default:
+			f->acc += x;
+			break;
+	}
+}
+
+uint16_t ADC_FilterResult(ADC_Filter *f) {
+	switch (f->type) {
+		case ADC_FILTER_OVERSAMPLE:	return f->acc >> f->shift;
+		case ADC_FILTER_AVERAGE:	return (f->acc + ((1 << f->shift) >> 1)) >> f->shift;	// Rounded
+		case ADC_FILTER_IIR:		return (f->state + (1 << (ADC_IIR_FRACTION_BITS - 1))) >> ADC_IIR_FRACTION_BITS;
+		case ADC_FILTER_CIC:		return f->acc >> (f->order * f->shift);	// Gain is 2^(m*n)
+		default:					return f->acc;
+	}
+}
@@ -32,41 +32,746 @@
 
 
 #include "Modules/LPC_ADC.h"
+#include "Modules/LPC_GPIO.h"
+#include "Modules/ADC_Filter.h"
+#include "Modules/ADC_Encode.h"
 
-SFPResult lpc_analogRead(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 1)
-		return SFP_ERR_ARG_COUNT;
+#define ADC_CLOCK_MAX		4500000	// Max ADC clock, Hz
+#define ADC_CONVERSION_CLOCKS	11	// Clocks per 10-bit conversion, fewer with CLKS (BURST mode only)
 
-	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
-		return SFP_ERR_ARG_TYPE;
+#define ADC_POWER_PER_CALL		0	// Powered for every conversion (default)
+#define ADC_POWER_ALWAYS_ON		1
+#define ADC_POWER_AUTO_OFF		2	// Powered off after the idle timeout
 
-	uint8_t pin = SFPFunction_getArgument_int32(msg, 0);
+static struct {
+	uint8_t policy;			// ADC_POWER_x
+	uint8_t clkdiv;			// ADC clock = PCLK/(clkdiv+1)
+	uint8_t clks;			// BURST resolution: 10-clks bits, 11-clks clocks per conversion
+	uint8_t powered;
+	uint32_t idleTimeout;	// ms
+	time_t lastUse;
+} ADCConfig = { ADC_POWER_PER_CALL, 15, 0, 0, 0, 0 };
 
-	if (pin > 7)
-		return SFP_ERR_ARG_VALUE;
+/*
+ * Streaming sample ring. The ADC ISR stores whole sweeps (one sample of every
+ * channel in the mask) and ADC_Process sends them in packed 10-bit blocks.
+ */
+#define ADC_BUFFER_SIZE_N		8
+#define ADC_BUFFER_MASK			((1 << ADC_BUFFER_SIZE_N) - 1)
+#define ADC_STREAM_BATCH		48	// Max samples in a single packed adc_stream message
+#define ADC_STREAM_DELTA_BATCH	120	// Max samples in a single delta encoded adc_stream message
+#define ADC_STREAM_BLOCK_BYTES	((ADC_STREAM_BATCH*10 + 7)/8)	// Delta blocks are cut at this size if possible
+#define ADC_STREAM_LATENCY		10	// ms, partial blocks are sent after this time
+
+#define ADC_STREAM_FLAG_OVERRUN	BIT0	// Sweeps were lost before this block
+#define ADC_STREAM_FLAG_DELTA	BIT1	// Block is delta encoded
+
+static uint16_t ADC_buffer[1 << ADC_BUFFER_SIZE_N];
+static volatile uint16_t ADC_latest[8];	// Latest streamed conversion of each channel, written by the ISR
+
+#define ADC_TRIGGER_NONE		0xFF	// BURST mode
+#define ADC_TRIGGER_CT16B0		0		// CT16B0_MAT0, PWM0 must be off
+#define ADC_TRIGGER_CT32B0		1		// CT32B0_MAT0, PWM1 must be off
+
+static volatile struct {
+	uint8_t active;
+	uint8_t trigger;		// ADC_TRIGGER_x
+	uint8_t channels;		// Channel mask
+	uint8_t channelCount;
+	uint8_t blockSize;		// Samples in a single adc_stream message
+	uint8_t encoding;		// ADC_ENCODING_x
+	uint32_t periodClocks;	// Sweep period in core clocks
+	time_us_t startTime;	// Time of the sweep 0
+	uint8_t overrun;		// Ring was full, the ISR drops sweeps until it's drained
+	uint16_t decimation;	// Sweeps per stored sweep
+	uint16_t skip;
+	uint32_t writePos;		// Written by the ISR only
+	uint32_t readPos;		// Written by ADC_Process only
+	uint32_t sequence;		// Sweeps stored or dropped, written by the ISR only
+	uint32_t dropped;		// Sweeps dropped, written by the ISR only
+	uint32_t readSequence;	// Sequence number of the sweep at readPos
+	uint8_t flags;			// Flags of the next block
+	time_t lastSend;
+	SFPFunctionType type;
+} ADCStream = { .trigger = ADC_TRIGGER_NONE };
+
+static void ADC_PowerUp(void) {
+	if (ADCConfig.powered) return;
 
 	LPC_SYSCON->PDRUNCFG &= ~BIT4;			// power up ADC
 	LPC_SYSCON->SYSAHBCLKCTRL |= BIT13;		// enable ADC clock
-	LPC_ADC->CR = (1 << pin) | (15 << 8) | (1 << 24);	//ADn, clock divider = 15+1, and start conversion
-
-	while (!(LPC_ADC->DR[pin] & BIT31));	// wait for conversion to end
-	uint16_t val = (LPC_ADC->DR[pin] >> 6) & 0x3FF;		// read value
+	ADCConfig.powered = 1;
+}
 
+static void ADC_PowerDown(void) {
 	LPC_ADC->CR = 0;						// stop ADC
 	LPC_SYSCON->SYSAHBCLKCTRL &= ~BIT13;	// stop ADC clock
 	LPC_SYSCON->PDRUNCFG |= BIT4;			// power down ADC
+	ADCConfig.powered = 0;
+}
+
+static void ADC_Release(void) {	// Conversions are done, power policy decides what's next
+	LPC_ADC->CR = 0;						// stop ADC
+	ADCConfig.lastUse = Time_getSystemTime();
+
+	if (ADCConfig.policy == ADC_POWER_PER_CALL)
+		ADC_PowerDown();
+}
+
+static ADC_Filter ADCFilters[8];
+
+/*
+ * Converts all channels in the mask in BURST mode, as many sweeps as the
+ * channel filters need.
+ */
+static void ADC_ReadChannels(uint8_t channels, uint16_t *values) {
+	uint8_t ch;
+
+	if (ADCStream.active) {	// The ADC is busy streaming, reading DR would clear the ISR's DONE flags
+		for (ch=0; ch<8; ch++) {
+			if (channels & (1 << ch))
+				values[ch] = ADC_latest[ch];
+		}
+		return;
+	}
+
+	uint32_t samples[8], sweeps = 1, i;
+	for (ch=0; ch<8; ch++) {
+		if (channels & (1 << ch)) {
+			samples[ch] = ADC_FilterSamples(&ADCFilters[ch]);
+			if (samples[ch] > sweeps) sweeps = samples[ch];
+			ADC_FilterReset(&ADCFilters[ch]);
+		}
+	}
+
+	ADC_PowerUp();
+	for (ch=0; ch<8; ch++) {	// Drop DONE flags of the previous conversions
+		if (channels & (1 << ch))
+			(void)LPC_ADC->DR[ch];
+	}
+
+	if ((channels & (channels - 1)) == 0 && sweeps == 1)	// Single conversion
+		LPC_ADC->CR = channels | (ADCConfig.clkdiv << 8) | (1 << 24);	//ADn, clock divider, and start conversion
+	else
+		LPC_ADC->CR = channels | (ADCConfig.clkdiv << 8) | BIT16 | (ADCConfig.clks << 17);	//ADn, clock divider, BURST
+
+	for (i=0; i<sweeps; i++) {
+		for (ch=0; ch<8; ch++) {
+			if ((channels & (1 << ch)) && i < samples[ch]) {
+				while (!(LPC_ADC->DR[ch] & BIT31));	// wait for conversion to end
+				ADC_FilterPut(&ADCFilters[ch], (LPC_ADC->DR[ch] >> 6) & 0x3FF, i);		// read value
+			}
+		}
+	}
+
+	ADC_Release();
+
+	for (ch=0; ch<8; ch++) {
+		if (channels & (1 << ch))
+			values[ch] = ADC_FilterResult(&ADCFilters[ch]);
+	}
+}
+
+SFPResult lpc_analogRead(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	SFPArgumentType pinType = SFPFunction_getArgumentType(msg, 0);
+	uint8_t *pins;
+	uint32_t pinCount, i;
+	uint8_t channels = 0;
+
+	if (pinType == SFP_ARG_INT) {
+		uint8_t pin = SFPFunction_getArgument_int32(msg, 0);
+		pins = &pin;
+		pinCount = 1;
+	} else if (pinType == SFP_ARG_BYTE_ARRAY) {
+		pins = SFPFunction_getArgument_barray(msg, 0, &pinCount);
+	} else {
+		return SFP_ERR_ARG_TYPE;
+	}
+
+	for (i=0; i<pinCount; i++) {  // Check argument values before any changes
+		if (pins[i] > 7)
+			return SFP_ERR_ARG_VALUE;
+		channels |= (1 << pins[i]);
+	}
+
+	if (channels == 0) return SFP_ERR_ARG_VALUE;
+
+	if (ADCStream.active && (channels & ~ADCStream.channels))	// Only streamed channels can be read
+		return SFP_ERR_ARG_VALUE;
+
+	uint8_t *packed = NULL;
+	if (pinType == SFP_ARG_BYTE_ARRAY) {
+		packed = MemoryManager_malloc(pinCount*2);
+		if (packed == NULL)
+			return SFP_ERR_ALLOC_FAILED;
+	}
+
+	uint16_t values[8];
+	time_us_t time = Time_getAlarmTime();
+	ADC_ReadChannels(channels, values);
 
 	SFPFunction *outFunc = SFPFunction_new();
 
-	if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+	if (outFunc == NULL) {
+		if (packed != NULL) MemoryManager_free(packed);
+		return SFP_ERR_ALLOC_FAILED;
+	}
 
 	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
 	SFPFunction_setID(outFunc, UPER_FID_ANALOGREAD);
 	SFPFunction_setName(outFunc, UPER_FNAME_ANALOGREAD);
-	SFPFunction_addArgument_int32(outFunc, pin);
-	SFPFunction_addArgument_int32(outFunc, val);
+	if (pinType == SFP_ARG_INT) {
+		SFPFunction_addArgument_int32(outFunc, pins[0]);
+		SFPFunction_addArgument_int32(outFunc, values[pins[0]]);
+	} else {	// analogRead(pins, values as 16-bit little endian, time)
+		for (i=0; i<pinCount; i++) {
+			packed[i*2] = values[pins[i]];
+			packed[i*2+1] = values[pins[i]] >> 8;
+		}
+
+		SFPFunction_addArgument_barray(outFunc, pins, pinCount);
+		SFPFunction_addArgument_barray(outFunc, packed, pinCount*2);
+		SFPFunction_addArgument_int32(outFunc, time);
+	}
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	if (packed != NULL)
+		MemoryManager_free(packed);
+
+	return SFP_OK;
+}
+
+void ADC_IRQHandler(void) {
+	uint16_t sweep[8];
+	uint8_t ch, n = 0;
+
+	for (ch=0; ch<8; ch++) {	// Reading the last channel clears the interrupt
+		if (ADCStream.channels & (1 << ch)) {
+			sweep[n] = (LPC_ADC->DR[ch] >> 6) & 0x3FF;
+			ADC_latest[ch] = sweep[n++];
+		}
+	}
+
+	if (ADCStream.skip != 0) {
+		ADCStream.skip--;
+		return;
+	}
+	ADCStream.skip = ADCStream.decimation - 1;
+
+	ADCStream.sequence++;
+
+	uint32_t writePos = ADCStream.writePos;
+	if (ADCStream.overrun || (writePos - ADCStream.readPos) + n > ADC_BUFFER_MASK + 1) {
+		ADCStream.overrun = 1;
+		ADCStream.dropped++;
+		return;
+	}
+
+	for (ch=0; ch<n; ch++)
+		ADC_buffer[(writePos + ch) & ADC_BUFFER_MASK] = sweep[ch];
+
+	ADCStream.writePos = writePos + n;	// Publish the sweep
+}
+
+/*
+ * adc_stream(sequence, flags, dropped, time, count, data): sequence and time
+ * are of the first sweep in the block, time is derived from the sweep index.
+ */
+static void ADC_SendStream(uint32_t count) {
+	uint8_t data[(ADC_STREAM_DELTA_BATCH*ADC_DELTA_MAX_BITS + 7)/8];
+	ADC_BitWriter w = { data, 0, 0 };
+	uint8_t flags = ADCStream.flags;
+
+	if (ADCStream.encoding == ADC_ENCODING_DELTA) {
+		flags |= ADC_STREAM_FLAG_DELTA;
+		count = ADC_EncodeDelta(ADC_buffer, ADC_BUFFER_MASK, ADCStream.readPos, count, ADCStream.channelCount,
+				(ADCStream.trigger == ADC_TRIGGER_NONE ? ADC_STREAM_BLOCK_BYTES : sizeof(data)), &w);
+	} else {
+		count = ADC_EncodePacked(ADC_buffer, ADC_BUFFER_MASK, ADCStream.readPos, count, &w);
+	}
+	ADC_FlushBits(&w);
+
+	time_us_t time = ADCStream.startTime
+			+ ((uint64_t)ADCStream.readSequence * ADCStream.periodClocks) / (SystemCoreClock / 1000000);
+
+	SFPFunction *func = SFPFunction_new();
+	if (func == NULL) return;
+
+	SFPFunction_setType(func, ADCStream.type);
+	SFPFunction_setID(func, UPER_FID_ADCSTREAM);
+	SFPFunction_setName(func, UPER_FNAME_ADCSTREAM);
+	SFPFunction_addArgument_int32(func, ADCStream.readSequence);
+	SFPFunction_addArgument_int32(func, flags);
+	SFPFunction_addArgument_int32(func, ADCStream.dropped);
+	SFPFunction_addArgument_int32(func, time);
+	SFPFunction_addArgument_int32(func, count);
+	SFPFunction_addArgument_barray(func, data, w.ptr - data);
+	SFPFunction_send(func, &stream);
+	SFPFunction_delete(func);
+
+	ADCStream.flags = 0;
+	ADCStream.readSequence += count / ADCStream.channelCount;
+	ADCStream.readPos += count;	// Release the sent samples
+	ADCStream.lastSend = Time_getSystemTime();
+}
+
+/*
+ * Threshold watch. Watched channels are sampled every ADCWatchPeriod ms (or
+ * taken from the stream) and an interrupt event is pushed when a channel
+ * enters or leaves its band.
+ */
+#define ADC_WATCH_BELOW			0
+#define ADC_WATCH_INSIDE		1
+#define ADC_WATCH_ABOVE			2
+#define ADC_WATCH_UNKNOWN		0xFF
+
+static struct {
+	uint16_t low, high;		// Band limits, in filtered analogRead units
+	uint16_t hysteresis;	// Distance into the band needed to re-enter it
+	uint8_t state;			// ADC_WATCH_x
+} ADCWatch[8];
+
+static uint8_t ADCWatchChannels;
+static uint32_t ADCWatchPeriod;	// ms
+static time_t ADCWatchLast;
+
+static uint8_t ADC_WatchState(uint8_t ch, uint16_t value) {
+	uint8_t state = ADCWatch[ch].state;
+	uint16_t low = ADCWatch[ch].low, high = ADCWatch[ch].high;
+
+	if (value < low) return ADC_WATCH_BELOW;
+	if (value > high) return ADC_WATCH_ABOVE;
+
+	// Inside the band, but the band is only re-entered past the hysteresis
+	if (state == ADC_WATCH_BELOW && value < low + ADCWatch[ch].hysteresis) return state;
+	if (state == ADC_WATCH_ABOVE && value + ADCWatch[ch].hysteresis > high) return state;
+
+	return ADC_WATCH_INSIDE;
+}
+
+static void ADC_Watch(void) {
+	if (ADCWatchChannels == 0 || (Time_getSystemTime() - ADCWatchLast) < ADCWatchPeriod)
+		return;
+	ADCWatchLast = Time_getSystemTime();
+
+	uint8_t channels = ADCWatchChannels;
+	if (ADCStream.active)
+		channels &= ADCStream.channels;	// Other channels can't be converted while streaming
+	if (channels == 0)
+		return;
+
+	uint16_t values[8];
+	uint8_t ch;
+	ADC_ReadChannels(channels, values);
+
+	for (ch=0; ch<8; ch++) {
+		if ((channels & (1 << ch)) == 0) continue;
+
+		uint8_t state = ADC_WatchState(ch, values[ch]);
+		if (state == ADCWatch[ch].state) continue;
+
+		if (ADCWatch[ch].state != ADC_WATCH_UNKNOWN) {	// The first sample only sets the state
+			__disable_irq();	// Event queue producers must not preempt each other
+			GPIO_PushEvent(GPIO_EVENT_SOURCE_ADC + ch, state, values[ch]);
+			__enable_irq();
+		}
+		ADCWatch[ch].state = state;
+	}
+}
+
+void ADC_Process(void) {
+	ADC_Watch();
+
+	if (!ADCStream.active) {
+		if (ADCConfig.powered && ADCConfig.policy == ADC_POWER_AUTO_OFF
+				&& (Time_getSystemTime() - ADCConfig.lastUse) >= ADCConfig.idleTimeout)
+			ADC_PowerDown();
+		return;
+	}
+
+	uint32_t available = ADCStream.writePos - ADCStream.readPos;
+
+	if (available >= ADCStream.blockSize) {
+		ADC_SendStream(ADCStream.blockSize);
+	} else if (available != 0 && ADCStream.trigger == ADC_TRIGGER_NONE	// Timed blocks are always full
+			&& (Time_getSystemTime() - ADCStream.lastSend) >= ADC_STREAM_LATENCY) {
+		ADC_SendStream(available);
+	} else if (available == 0 && ADCStream.overrun) {	// Drained, resume storing
+		__disable_irq();
+		ADCStream.readSequence = ADCStream.sequence;
+		ADCStream.flags |= ADC_STREAM_FLAG_OVERRUN;
+		ADCStream.overrun = 0;
+		__enable_irq();
+	}
+}
+
+static void ADC_StreamStop(void) {
+	NVIC_DisableIRQ(ADC_IRQn);
+	LPC_ADC->INTEN = 0;
+	ADC_Release();
+
+	if (ADCStream.trigger == ADC_TRIGGER_CT16B0) {
+		LPC_CT16B0->EMR = 0;	// Disable external outputs
+		LPC_CT16B0->TCR = 0;	// Disable timer
+		LPC_SYSCON->SYSAHBCLKCTRL &= ~BIT7;	// Disable clock for CT16B0
+	} else if (ADCStream.trigger == ADC_TRIGGER_CT32B0) {
+		LPC_CT32B0->EMR = 0;	// Disable external outputs
+		LPC_CT32B0->TCR = 0;	// Disable timer
+		LPC_SYSCON->SYSAHBCLKCTRL &= ~BIT9;	// Disable clock for CT32B0
+	}
+
+	ADCStream.trigger = ADC_TRIGGER_NONE;
+	ADCStream.active = 0;
+}
+
+static void ADC_StreamReset(uint8_t channels, uint8_t count, uint8_t encoding, SFPFunctionType type) {
+	uint32_t batch = (encoding == ADC_ENCODING_DELTA ? ADC_STREAM_DELTA_BATCH : ADC_STREAM_BATCH);
+
+	ADCStream.channels = channels;
+	ADCStream.channelCount = count;
+	ADCStream.blockSize = (batch / count) * count;	// Whole sweeps only
+	ADCStream.encoding = encoding;
+	ADCStream.decimation = 1;
+	ADCStream.skip = 0;
+	ADCStream.overrun = 0;
+	ADCStream.writePos = 0;
+	ADCStream.readPos = 0;
+	ADCStream.sequence = 0;
+	ADCStream.dropped = 0;
+	ADCStream.readSequence = 0;
+	ADCStream.flags = 0;
+	ADCStream.lastSend = Time_getSystemTime();
+	ADCStream.type = type;
+}
+
+SFPResult lpc_adc_stream_begin(SFPFunction *msg) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 2 && argCount != 3)
+		return SFP_ERR_ARG_COUNT;
+
+	SFPArgumentType chType = SFPFunction_getArgumentType(msg, 0);
+	if ((chType != SFP_ARG_INT && chType != SFP_ARG_BYTE_ARRAY)
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| (argCount == 3 && SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT))
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_channels = 0;
+	uint32_t p_rate = SFPFunction_getArgument_int32(msg, 1);	// Sweeps per second
+	uint8_t p_encoding = (argCount == 3 ? SFPFunction_getArgument_int32(msg, 2) : ADC_ENCODING_PACKED);
+
+	if (p_encoding > ADC_ENCODING_DELTA) return SFP_ERR_ARG_VALUE;
+
+	if (chType == SFP_ARG_INT) {	// Channel mask
+		uint32_t mask = SFPFunction_getArgument_int32(msg, 0);
+		if (mask > 0xFF) return SFP_ERR_ARG_VALUE;
+		p_channels = mask;
+	} else {						// Channel list
+		uint32_t count, i;
+		uint8_t *channels = SFPFunction_getArgument_barray(msg, 0, &count);
+		for (i=0; i<count; i++) {
+			if (channels[i] > 7) return SFP_ERR_ARG_VALUE;
+			p_channels |= (1 << channels[i]);
+		}
+	}
+
+	if (p_channels == 0 || p_rate == 0) return SFP_ERR_ARG_VALUE;
+
+	uint8_t ch, count = 0, last = 0;
+	for (ch=0; ch<8; ch++) {
+		if (p_channels & (1 << ch)) {
+			count++;
+			last = ch;
+		}
+	}
+
+	/*
+	 * BURST mode converts the channels back to back, so the sweep rate is set by
+	 * the ADC clock. Rates below the slowest clock are decimated in the ISR.
+	 */
+	uint32_t conversionClocks = ADC_CONVERSION_CLOCKS - ADCConfig.clks;
+	uint32_t clocksPerSweep = p_rate * conversionClocks * count;
+	if (clocksPerSweep > ADC_CLOCK_MAX || clocksPerSweep / count / conversionClocks != p_rate)
+		return SFP_ERR_ARG_VALUE;
+
+	uint32_t decimation = 1;
+	uint32_t div = SystemCoreClock / clocksPerSweep;
+	if (div > 256) {
+		decimation = (div + 255) / 256;
+		if (decimation > 0xFFFF) return SFP_ERR_ARG_VALUE;
+		div = SystemCoreClock / (clocksPerSweep * decimation);
+	}
+	if (div * ADC_CLOCK_MAX < SystemCoreClock) div++;	// Round down the ADC clock, not up
+
+	if (ADCStream.active)
+		ADC_StreamStop();
+
+	ADC_StreamReset(p_channels, count, p_encoding, SFPFunction_getType(msg));
+	ADCStream.decimation = decimation;
+	ADCStream.periodClocks = div * conversionClocks * count * decimation;
+	ADCStream.startTime = Time_getAlarmTime() + ADCStream.periodClocks / (SystemCoreClock / 1000000);
+	ADCStream.active = 1;
+
+	ADC_PowerUp();
+	LPC_ADC->INTEN = (1 << last);	// The last channel ends the sweep
+	NVIC_SetPriority(ADC_IRQn, 2);
+	NVIC_EnableIRQ(ADC_IRQn);
+	LPC_ADC->CR = p_channels | ((div - 1) << 8) | BIT16 | (ADCConfig.clks << 17);	// ADn, clock divider, BURST, resolution
+
+	SFPFunction *outFunc = SFPFunction_new();
+
+	if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+
+	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+	SFPFunction_setID(outFunc, UPER_FID_ADCSTREAMBEGIN);
+	SFPFunction_setName(outFunc, UPER_FNAME_ADCSTREAMBEGIN);
+	SFPFunction_addArgument_int32(outFunc, SystemCoreClock / (div * conversionClocks * count * decimation));	// Actual rate
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	return SFP_OK;
+}
+
+/*
+ * Single channel conversions started by the timer match output (CR START). The
+ * match output toggles, so the timer matches at twice the sample rate. Sample
+ * times are startTime + index/rate, the USB delivery time doesn't matter.
+ */
+SFPResult lpc_adc_timed_begin(SFPFunction *msg) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 4 && argCount != 5)
+		return SFP_ERR_ARG_COUNT;
+
+	uint32_t i;
+	for (i=0; i<argCount; i++) {
+		if (SFPFunction_getArgumentType(msg, i) != SFP_ARG_INT)
+			return SFP_ERR_ARG_TYPE;
+	}
+
+	uint8_t p_channel = SFPFunction_getArgument_int32(msg, 0);
+	uint32_t p_rate = SFPFunction_getArgument_int32(msg, 1);		// Samples per second
+	uint32_t p_blockSize = SFPFunction_getArgument_int32(msg, 2);	// Samples per adc_stream message
+	uint8_t p_trigger = SFPFunction_getArgument_int32(msg, 3);		// 0 - CT16B0, 1 - CT32B0
+	uint8_t p_encoding = (argCount == 5 ? SFPFunction_getArgument_int32(msg, 4) : ADC_ENCODING_PACKED);
+
+	if (p_channel > 7 || p_blockSize == 0 || p_trigger > ADC_TRIGGER_CT32B0 || p_encoding > ADC_ENCODING_DELTA
+			|| p_blockSize > (p_encoding == ADC_ENCODING_DELTA ? ADC_STREAM_DELTA_BATCH : ADC_STREAM_BATCH))
+		return SFP_ERR_ARG_VALUE;
+
+	uint32_t adcClock = SystemCoreClock / (ADCConfig.clkdiv + 1);
+	if (p_rate == 0 || p_rate > adcClock / ADC_CONVERSION_CLOCKS)	// Conversion must end before the next trigger
+		return SFP_ERR_ARG_VALUE;
+
+	if (ADCStream.active)
+		ADC_StreamStop();
+
+	uint32_t clockBit = (p_trigger == ADC_TRIGGER_CT16B0 ? BIT7 : BIT9);
+	if (LPC_SYSCON->SYSAHBCLKCTRL & clockBit) return SFP_ERR_ARG_VALUE;	// Timer is used by PWM
+
+	uint32_t halfPeriod = SystemCoreClock / (2 * p_rate);	// Timer clocks between toggles
+	uint32_t prescaler = 1;
+	if (p_trigger == ADC_TRIGGER_CT16B0)
+		prescaler = (halfPeriod >> 16) + 1;	// Fit into the 16 bit timer
+	uint32_t match = halfPeriod / prescaler;
+
+	ADC_StreamReset(1 << p_channel, 1, p_encoding, SFPFunction_getType(msg));
+	ADCStream.blockSize = p_blockSize;
+	ADCStream.trigger = p_trigger;
+	ADCStream.periodClocks = 2 * match * prescaler;
+
+	ADC_PowerUp();
+	(void)LPC_ADC->DR[p_channel];	// Drop DONE flag of the previous conversion
+	LPC_ADC->INTEN = (1 << p_channel);
+	NVIC_SetPriority(ADC_IRQn, 2);
+	NVIC_EnableIRQ(ADC_IRQn);
+
+	LPC_SYSCON->SYSAHBCLKCTRL |= clockBit;	// enable clock for the timer
+
+	if (p_trigger == ADC_TRIGGER_CT16B0) {
+		LPC_CT16B0->TCR = BIT0 | BIT1;	// Enable timer, but keep in reset state
+		LPC_CT16B0->PR = prescaler - 1;
+		LPC_CT16B0->MCR = BIT1;			// Reset timer on MR0
+		LPC_CT16B0->MR0 = match - 1;
+		LPC_CT16B0->EMR = (3 << 4);		// Toggle MAT0 on match, pin isn't needed
+		LPC_ADC->CR = (1 << p_channel) | (ADCConfig.clkdiv << 8) | (6 << 24);	// ADn, clock divider, start on CT16B0_MAT0 rise
+	} else {
+		LPC_CT32B0->TCR = BIT0 | BIT1;	// Enable timer, but keep in reset state
+		LPC_CT32B0->PR = 0;
+		LPC_CT32B0->MCR = BIT1;			// Reset timer on MR0
+		LPC_CT32B0->MR0 = match - 1;
+		LPC_CT32B0->EMR = (3 << 4);		// Toggle MAT0 on match, pin isn't needed
+		LPC_ADC->CR = (1 << p_channel) | (ADCConfig.clkdiv << 8) | (4 << 24);	// ADn, clock divider, start on CT32B0_MAT0 rise
+	}
+
+	// MAT0 starts low, so the first match is a rising edge and takes the sample 0
+	time_us_t startTime = Time_getAlarmTime() + (ADCStream.periodClocks / 2) / (SystemCoreClock / 1000000);
+	ADCStream.startTime = startTime;
+	ADCStream.active = 1;
+
+	if (p_trigger == ADC_TRIGGER_CT16B0)
+		LPC_CT16B0->TCR &= ~BIT1;	// disable reset
+	else
+		LPC_CT32B0->TCR &= ~BIT1;	// disable reset
+
+	uint32_t rate_mHz = ((uint64_t)SystemCoreClock * 1000) / (2 * match * prescaler);
+
+	SFPFunction *outFunc = SFPFunction_new();
+
+	if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+
+	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+	SFPFunction_setID(outFunc, UPER_FID_ADCTIMEDBEGIN);
+	SFPFunction_setName(outFunc, UPER_FNAME_ADCTIMEDBEGIN);
+	SFPFunction_addArgument_int32(outFunc, rate_mHz);	// Actual rate
+	SFPFunction_addArgument_int32(outFunc, startTime);	// Time of the sample 0
 	SFPFunction_send(outFunc, &stream);
 	SFPFunction_delete(outFunc);
 
 	return SFP_OK;
 }
+
+SFPResult lpc_adc_stream_end(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 0)
+		return SFP_ERR_ARG_COUNT;
+
+	if (ADCStream.active)
+		ADC_StreamStop();
+
+	return SFP_OK;
+}
+
+SFPResult lpc_adc_config(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 4)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_policy = SFPFunction_getArgument_int32(msg, 0);	// 0 - per call, 1 - always on, 2 - auto off
+	uint32_t p_timeout = SFPFunction_getArgument_int32(msg, 1);	// Idle timeout in ms for auto off
+	uint32_t p_clkdiv = SFPFunction_getArgument_int32(msg, 2);	// ADC clock = 48MHz/(clkdiv+1), max 4.5MHz
+	uint32_t p_bits = SFPFunction_getArgument_int32(msg, 3);	// BURST resolution, 3-10 bits
+
+	if (p_policy > ADC_POWER_AUTO_OFF || p_clkdiv > 255 || p_bits < 3 || p_bits > 10
+			|| SystemCoreClock / (p_clkdiv + 1) > ADC_CLOCK_MAX)
+		return SFP_ERR_ARG_VALUE;
+
+	if (ADCStream.active) return SFP_ERR_ARG_VALUE;	// Can't be changed while streaming
+
+	ADCConfig.policy = p_policy;
+	ADCConfig.idleTimeout = p_timeout;
+	ADCConfig.clkdiv = p_clkdiv;
+	ADCConfig.clks = 10 - p_bits;
+	ADCConfig.lastUse = Time_getSystemTime();
+
+	if (p_policy == ADC_POWER_ALWAYS_ON)
+		ADC_PowerUp();
+	else if (p_policy == ADC_POWER_PER_CALL && ADCConfig.powered)
+		ADC_PowerDown();
+
+	return SFP_OK;
+}
+
+SFPResult lpc_adc_filter(SFPFunction *msg) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 3 && argCount != 4)
+		return SFP_ERR_ARG_COUNT;
+
+	SFPArgumentType pinType = SFPFunction_getArgumentType(msg, 0);
+	if ((pinType != SFP_ARG_INT && pinType != SFP_ARG_BYTE_ARRAY)
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT
+			|| (argCount == 4 && SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT))
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t *pins;
+	uint32_t pinCount, i;
+
+	if (pinType == SFP_ARG_INT) {
+		uint8_t pin = SFPFunction_getArgument_int32(msg, 0);
+		pins = &pin;
+		pinCount = 1;
+	} else {
+		pins = SFPFunction_getArgument_barray(msg, 0, &pinCount);
+	}
+
+	uint8_t p_type = SFPFunction_getArgument_int32(msg, 1);
+	uint32_t p_shift = SFPFunction_getArgument_int32(msg, 2);	// n
+	uint32_t p_order = (argCount == 4 ? SFPFunction_getArgument_int32(msg, 3) : 1);	// m (CIC)
+
+	switch (p_type) {	// Keep the conversion count and the CIC gain within limits
+		case ADC_FILTER_NONE:		p_shift = 0; break;
+		case ADC_FILTER_OVERSAMPLE:	if (p_shift < 1 || p_shift > 4) return SFP_ERR_ARG_VALUE; break;
+		case ADC_FILTER_AVERAGE:	if (p_shift > 8) return SFP_ERR_ARG_VALUE; break;
+		case ADC_FILTER_IIR:		if (p_shift < 1 || p_shift > 8) return SFP_ERR_ARG_VALUE; break;
+		case ADC_FILTER_CIC: {
+			if (p_shift < 1 || p_shift > 6 || p_order < 1 || p_order > ADC_CIC_MAX_ORDER)
+				return SFP_ERR_ARG_VALUE;
+			break;
+		}
+		default:
+			return SFP_ERR_ARG_VALUE;
+	}
+
+	for (i=0; i<pinCount; i++) {  // Check argument values before any changes
+		if (pins[i] > 7)
+			return SFP_ERR_ARG_VALUE;
+	}
+
+	for (i=0; i<pinCount; i++) {
+		ADC_Filter *f = &ADCFilters[pins[i]];
+
+		f->type = p_type;
+		f->shift = p_shift;
+		f->order = p_order;
+		f->primed = 0;
+	}
+
+	return SFP_OK;
+}
+
+SFPResult lpc_adc_watch(SFPFunction *msg) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 1 && argCount != 5)
+		return SFP_ERR_ARG_COUNT;
+
+	uint32_t i;
+	for (i=0; i<argCount; i++) {
+		if (SFPFunction_getArgumentType(msg, i) != SFP_ARG_INT)
+			return SFP_ERR_ARG_TYPE;
+	}
+
+	uint8_t p_channel = SFPFunction_getArgument_int32(msg, 0);
+	if (p_channel > 7) return SFP_ERR_ARG_VALUE;
+
+	if (argCount == 1) {	// adc_watch(channel) stops watching
+		ADCWatchChannels &= ~(1 << p_channel);
+		return SFP_OK;
+	}
+
+	uint32_t p_low = SFPFunction_getArgument_int32(msg, 1);
+	uint32_t p_high = SFPFunction_getArgument_int32(msg, 2);
+	uint32_t p_hysteresis = SFPFunction_getArgument_int32(msg, 3);
+	uint32_t p_period = SFPFunction_getArgument_int32(msg, 4);	// Sampling period in ms, shared by all channels
+
+	if (p_low > p_high || p_high > 0xFFFF || p_hysteresis > p_high - p_low)
+		return SFP_ERR_ARG_VALUE;
+
+	ADCWatch[p_channel].low = p_low;
+	ADCWatch[p_channel].high = p_high;
+	ADCWatch[p_channel].hysteresis = p_hysteresis;
+	ADCWatch[p_channel].state = ADC_WATCH_UNKNOWN;
+
+	ADCWatchPeriod = p_period;
+	ADCWatchChannels |= (1 << p_channel);
+
+	GPIO_SetEventType(GPIO_EVENT_SOURCE_ADC + p_channel, SFPFunction_getType(msg));
+
+	return SFP_OK;
+}
@@ -0,0 +1,267 @@
+/**
+ * @file	LPC_COUNTER.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include "Modules/LPC_COUNTER.h"
+#include "Modules/LPC_GPIO.h"
+
+#define COUNTER_HW		(-1)	// intID of the counter clocked by CT16B1
+
+typedef struct {
+	uint8_t active;
+	int8_t intID;			// Pin interrupt channel or COUNTER_HW
+	uint8_t edgesPerCycle;	// 2 if both edges are counted
+	uint32_t period;		// Report period in milliseconds, 0 - reports on demand only
+	SFPFunctionType type;
+
+	volatile uint32_t edges;	// Edges counted by the pin interrupt
+
+	time_t gateStart;		// Time_getSystemTime() at the window start
+	time_us_t gateTime;		// Time_getAlarmTime() at the window start
+	uint32_t gateEdges;		// Edge count at the window start
+
+	uint32_t windowEdges;	// Edges counted in the last completed window
+	time_us_t windowTime;	// Length of the last completed window
+} Counter_t;
+
+static Counter_t counters[COUNTER_COUNT];
+static uint8_t COUNTER_INTERRUPT_MAP[LPC_INTERRUPT_COUNT];	// Pin interrupt channel -> counter ID
+static volatile uint32_t COUNTER_hwOverflows;
+static uint8_t COUNTER_hwUsed;
+
+void TIMER16_1_IRQHandler(void) {
+	LPC_CT16B1->IR = BIT0;	// Clear MR0 (wrap) flag
+	COUNTER_hwOverflows++;
+}
+
+static void COUNTER_InterruptHandler(uint8_t intID) {
+	uint8_t intBit = (1 << intID);
+	uint32_t edges = 0;
+
+	if ((LPC_GPIO_PIN_INT->RISE & intBit) && (LPC_GPIO_PIN_INT->IENR & intBit))
+		edges++;
+	if ((LPC_GPIO_PIN_INT->FALL & intBit) && (LPC_GPIO_PIN_INT->IENF & intBit))
+		edges++;
+
+	LPC_GPIO_PIN_INT->RISE = intBit;	// Clear rising edge (sort of) flag
+	LPC_GPIO_PIN_INT->FALL = intBit;	// Clear falling edge (sort of) flag
+
+	counters[COUNTER_INTERRUPT_MAP[intID]].edges += edges;
+}
+
+static uint32_t COUNTER_getEdges(Counter_t *counter) {
+	if (counter->intID != COUNTER_HW)
+		return counter->edges;
+
+	__disable_irq();
+	uint32_t overflows = COUNTER_hwOverflows;
+	uint32_t count = LPC_CT16B1->TC;
+	if (LPC_CT16B1->IR & BIT0) {	// Wrapped, but not yet seen by the ISR
+		count = LPC_CT16B1->TC;
+		overflows++;
+	}
+	__enable_irq();
+
+	return (overflows << 16) | count;
+}
+
+static void COUNTER_CloseWindow(Counter_t *counter) {
+	uint32_t edges = COUNTER_getEdges(counter);
+	time_us_t time = Time_getAlarmTime();
+
+	counter->windowEdges = edges - counter->gateEdges;
+	counter->windowTime = time - counter->gateTime;
+
+	counter->gateEdges = edges;
+	counter->gateTime = time;
+	counter->gateStart = Time_getSystemTime();
+}
+
+static void COUNTER_Send(uint8_t counterID) {
+	Counter_t *counter = &counters[counterID];
+
+	uint32_t frequency = 0;	// in millihertz
+	if (counter->windowTime != 0)
+		frequency = ((uint64_t)counter->windowEdges * 1000000000ULL) / ((uint64_t)counter->windowTime * counter->edgesPerCycle);
+
+	SFPFunction *outFunc = SFPFunction_new();
+	if (outFunc == NULL) return;
+
+	SFPFunction_setType(outFunc, counter->type);
+	SFPFunction_setID(outFunc, UPER_FID_COUNTERREAD);
+	SFPFunction_setName(outFunc, UPER_FNAME_COUNTERREAD);
+	SFPFunction_addArgument_int32(outFunc, counterID);
+	SFPFunction_addArgument_int32(outFunc, counter->gateEdges);	// Total edges
+	SFPFunction_addArgument_int32(outFunc, counter->windowEdges);
+	SFPFunction_addArgument_int32(outFunc, counter->windowTime);
+	SFPFunction_addArgument_int32(outFunc, frequency);
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+}
+
+static void COUNTER_Stop(uint8_t counterID) {
+	Counter_t *counter = &counters[counterID];
+
+	if (!counter->active)
+		return;
+
+	if (counter->intID == COUNTER_HW) {
+		NVIC_DisableIRQ(TIMER_16_1_IRQn);
+		LPC_CT16B1->TCR = 0;	// Disable timer
+		LPC_SYSCON->SYSAHBCLKCTRL &= ~BIT8;	// Disable clock for CT16B1
+		*LPC_PIN_REGISTERS[COUNTER_HW_PIN] &= ~7;	// Back to GPIO function
+		COUNTER_hwUsed = 0;
+	} else {
+		GPIO_FreeInterrupt(counter->intID);
+	}
+
+	counter->active = 0;
+}
+
+void COUNTER_Process(void) {
+	uint8_t i;
+	for (i=0; i<COUNTER_COUNT; i++) {
+		Counter_t *counter = &counters[i];
+
+		if (counter->active && counter->period != 0
+				&& (Time_getSystemTime() - counter->gateStart) >= counter->period) {
+			COUNTER_CloseWindow(counter);
+			COUNTER_Send(i);
+		}
+	}
+}
+
+SFPResult lpc_counter_begin(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 4)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_counterID = SFPFunction_getArgument_int32(msg, 0);
+	uint8_t p_pin = SFPFunction_getArgument_int32(msg, 1);
+	uint8_t p_mode = SFPFunction_getArgument_int32(msg, 2);	// 2 - CHANGE, 3 - RISING, 4 - FALLING
+	uint32_t p_period = SFPFunction_getArgument_int32(msg, 3);	// Report period in ms, 0 - counter_read only
+
+	if (p_counterID >= COUNTER_COUNT || p_pin >= LPC_PIN_COUNT || p_mode < 2 || p_mode > 4)
+		return SFP_ERR_ARG_VALUE;
+
+	COUNTER_Stop(p_counterID);
+
+	Counter_t *counter = &counters[p_counterID];
+
+	if (p_pin == COUNTER_HW_PIN && !COUNTER_hwUsed) {
+		COUNTER_hwUsed = 1;
+		counter->intID = COUNTER_HW;
+
+		LPC_SYSCON->SYSAHBCLKCTRL |= BIT8;	// enable clock for CT16B1
+		*LPC_PIN_REGISTERS[p_pin] = (*LPC_PIN_REGISTERS[p_pin] & ~7) | 1;	// CT16B1_CAP0 function
+
+		LPC_CT16B1->TCR = BIT1;	// Keep timer in reset state
+		LPC_CT16B1->PR = 0;
+		LPC_CT16B1->CCR = 0;	// No captures
+		LPC_CT16B1->CTCR = (p_mode == 2 ? 3 : p_mode - 2);	// Count CAP0 edges: 1 - rising, 2 - falling, 3 - both
+		LPC_CT16B1->MR0 = 0;
+		LPC_CT16B1->MCR = BIT0;	// Interrupt on wrap to 0
+		LPC_CT16B1->TCR = BIT0;	// Enable timer
+		LPC_CT16B1->IR = 0xF;
+
+		COUNTER_hwOverflows = 0;
+		NVIC_SetPriority(TIMER_16_1_IRQn, 1);
+		NVIC_EnableIRQ(TIMER_16_1_IRQn);
+	} else {
+		int8_t intID = GPIO_AllocInterrupt(COUNTER_InterruptHandler);
+		if (intID < 0) return SFP_ERR_ARG_VALUE;	// All interrupt channels are in use
+
+		counter->intID = intID;
+		counter->edges = 0;
+		COUNTER_INTERRUPT_MAP[intID] = p_counterID;
+
+		GPIO_ConfigInterrupt(intID, p_pin, p_mode);
+	}
+
+	counter->active = 1;
+	counter->edgesPerCycle = (p_mode == 2 ? 2 : 1);
+	counter->period = p_period;
+	counter->type = SFPFunction_getType(msg);
+
+	counter->gateEdges = 0;
+	counter->gateTime = Time_getAlarmTime();
+	counter->gateStart = Time_getSystemTime();
+	counter->windowEdges = 0;
+	counter->windowTime = 0;
+
+	return SFP_OK;
+}
+
+SFPResult lpc_counter_read(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_counterID = SFPFunction_getArgument_int32(msg, 0);
+
+	if (p_counterID >= COUNTER_COUNT || !counters[p_counterID].active)
+		return SFP_ERR_ARG_VALUE;
+
+	Counter_t *counter = &counters[p_counterID];
+
+	if (counter->period == 0)	// On demand counters are gated by the reads
+		COUNTER_CloseWindow(counter);
+
+	counter->type = SFPFunction_getType(msg);
+	COUNTER_Send(p_counterID);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_counter_end(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_counterID = SFPFunction_getArgument_int32(msg, 0);
+
+	if (p_counterID >= COUNTER_COUNT)
+		return SFP_ERR_ARG_VALUE;
+
+	COUNTER_Stop(p_counterID);
+
+	return SFP_OK;
+}
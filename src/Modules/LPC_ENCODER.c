@@ -0,0 +1,256 @@
+/**
+ * @file	LPC_ENCODER.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include "Modules/LPC_ENCODER.h"
+#include "Modules/LPC_GPIO.h"
+
+#define ENCODER_ERROR	2	// Both channels changed at once, direction unknown
+
+/*
+ * Position change for the transition (previous state << 2) | state,
+ * where state is (A << 1) | B. Forward sequence is 00 -> 01 -> 11 -> 10.
+ */
+static int8_t const ENCODER_TRANSITIONS[16] = {
+		0,				+1,				-1,				ENCODER_ERROR,
+		-1,				0,				ENCODER_ERROR,	+1,
+		+1,				ENCODER_ERROR,	0,				-1,
+		ENCODER_ERROR,	-1,				+1,				0,
+};
+
+typedef struct {
+	uint8_t active;
+	int8_t intID[2];		// Pin interrupt channels of A and B
+	uint8_t port[2];
+	uint32_t pinMask[2];
+	SFPFunctionType type;
+
+	volatile uint8_t state;
+	volatile int32_t position;
+	volatile uint32_t errors;
+
+	int32_t velocity;			// Counts per second
+	int32_t velocityPosition;	// Position at the velocity window start
+	time_us_t velocityTime;		// Time_getAlarmTime() at the velocity window start
+
+	uint32_t reportInterval;	// Minimum time between change reports in ms, 0 - no reports
+	int32_t reportedPosition;
+	time_t reportTime;
+} Encoder_t;
+
+static Encoder_t encoders[ENCODER_COUNT];
+static uint8_t ENCODER_INTERRUPT_MAP[LPC_INTERRUPT_COUNT];	// Pin interrupt channel -> encoder ID
+
+static inline uint8_t ENCODER_readState(Encoder_t *encoder) {
+	uint8_t state = 0;
+
+	if (LPC_GPIO->PIN[encoder->port[0]] & encoder->pinMask[0])
+		state |= 2;
+	if (LPC_GPIO->PIN[encoder->port[1]] & encoder->pinMask[1])
+		state |= 1;
+
+	return state;
+}
+
+static void ENCODER_InterruptHandler(uint8_t intID) {
+	LPC_GPIO_PIN_INT->RISE = (1 << intID);	// Clear rising edge (sort of) flag
+	LPC_GPIO_PIN_INT->FALL = (1 << intID);	// Clear falling edge (sort of) flag
+
+	Encoder_t *encoder = &encoders[ENCODER_INTERRUPT_MAP[intID]];
+
+	uint8_t state = ENCODER_readState(encoder);
+	int8_t step = ENCODER_TRANSITIONS[(encoder->state << 2) | state];
+
+	if (step == ENCODER_ERROR)
+		encoder->errors++;
+	else
+		encoder->position += step;
+
+	encoder->state = state;
+}
+
+static void ENCODER_Send(uint8_t encoderID) {
+	Encoder_t *encoder = &encoders[encoderID];
+
+	SFPFunction *outFunc = SFPFunction_new();
+	if (outFunc == NULL) return;
+
+	SFPFunction_setType(outFunc, encoder->type);
+	SFPFunction_setID(outFunc, UPER_FID_ENCODERREAD);
+	SFPFunction_setName(outFunc, UPER_FNAME_ENCODERREAD);
+	SFPFunction_addArgument_int32(outFunc, encoderID);
+	SFPFunction_addArgument_int32(outFunc, encoder->position);
+	SFPFunction_addArgument_int32(outFunc, encoder->velocity);
+	SFPFunction_addArgument_int32(outFunc, encoder->errors);
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+}
+
+static void ENCODER_Stop(uint8_t encoderID) {
+	Encoder_t *encoder = &encoders[encoderID];
+
+	if (encoder->intID[0] >= 0)
+		GPIO_FreeInterrupt(encoder->intID[0]);
+	if (encoder->intID[1] >= 0)
+		GPIO_FreeInterrupt(encoder->intID[1]);
+
+	encoder->intID[0] = encoder->intID[1] = -1;
+	encoder->active = 0;
+}
+
+void ENCODER_Process(void) {
+	uint8_t i;
+	for (i=0; i<ENCODER_COUNT; i++) {
+		Encoder_t *encoder = &encoders[i];
+
+		if (!encoder->active)
+			continue;
+
+		time_us_t time = Time_getAlarmTime();
+		time_us_t elapsed = time - encoder->velocityTime;
+
+		if (elapsed >= ENCODER_VELOCITY_PERIOD*1000) {
+			int32_t position = encoder->position;
+
+			encoder->velocity = ((int64_t)(position - encoder->velocityPosition) * 1000000) / (int64_t)elapsed;
+			encoder->velocityPosition = position;
+			encoder->velocityTime = time;
+		}
+
+		if (encoder->reportInterval != 0 && encoder->position != encoder->reportedPosition
+				&& (Time_getSystemTime() - encoder->reportTime) >= encoder->reportInterval) {
+			encoder->reportedPosition = encoder->position;
+			encoder->reportTime = Time_getSystemTime();
+			ENCODER_Send(i);
+		}
+	}
+}
+
+SFPResult lpc_encoder_begin(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 4)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_encoderID = SFPFunction_getArgument_int32(msg, 0);
+	uint8_t p_pins[2];
+	p_pins[0] = SFPFunction_getArgument_int32(msg, 1);	// Channel A
+	p_pins[1] = SFPFunction_getArgument_int32(msg, 2);	// Channel B
+	uint32_t p_reportInterval = SFPFunction_getArgument_int32(msg, 3);	// ms, 0 - encoder_read only
+
+	if (p_encoderID >= ENCODER_COUNT || p_pins[0] >= LPC_PIN_COUNT || p_pins[1] >= LPC_PIN_COUNT || p_pins[0] == p_pins[1])
+		return SFP_ERR_ARG_VALUE;
+
+	if (encoders[p_encoderID].active)
+		ENCODER_Stop(p_encoderID);
+
+	Encoder_t *encoder = &encoders[p_encoderID];
+	uint8_t i;
+
+	encoder->intID[0] = GPIO_AllocInterrupt(ENCODER_InterruptHandler);
+	encoder->intID[1] = GPIO_AllocInterrupt(ENCODER_InterruptHandler);
+
+	if (encoder->intID[0] < 0 || encoder->intID[1] < 0) {	// Not enough free interrupt channels
+		ENCODER_Stop(p_encoderID);
+		return SFP_ERR_ARG_VALUE;
+	}
+
+	for (i=0; i<2; i++) {
+		uint8_t port = 0;
+		uint8_t pinNum = LPC_PIN_IDS[p_pins[i]];
+		if (pinNum > 23) {	// if not PIO0_0 to PIO0_23
+			port = 1;
+			pinNum -= 24;
+		}
+
+		encoder->port[i] = port;
+		encoder->pinMask[i] = (1 << pinNum);
+		ENCODER_INTERRUPT_MAP[encoder->intID[i]] = p_encoderID;
+	}
+
+	encoder->type = SFPFunction_getType(msg);
+	encoder->state = ENCODER_readState(encoder);
+	encoder->position = 0;
+	encoder->errors = 0;
+	encoder->velocity = 0;
+	encoder->velocityPosition = 0;
+	encoder->velocityTime = Time_getAlarmTime();
+	encoder->reportInterval = p_reportInterval;
+	encoder->reportedPosition = 0;
+	encoder->reportTime = Time_getSystemTime();
+	encoder->active = 1;
+
+	GPIO_ConfigInterrupt(encoder->intID[0], p_pins[0], 2);	// Edge CHANGE mode
+	GPIO_ConfigInterrupt(encoder->intID[1], p_pins[1], 2);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_encoder_read(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_encoderID = SFPFunction_getArgument_int32(msg, 0);
+
+	if (p_encoderID >= ENCODER_COUNT || !encoders[p_encoderID].active)
+		return SFP_ERR_ARG_VALUE;
+
+	encoders[p_encoderID].type = SFPFunction_getType(msg);
+	ENCODER_Send(p_encoderID);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_encoder_end(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_encoderID = SFPFunction_getArgument_int32(msg, 0);
+
+	if (p_encoderID >= ENCODER_COUNT)
+		return SFP_ERR_ARG_VALUE;
+
+	if (encoders[p_encoderID].active)
+		ENCODER_Stop(p_encoderID);
+
+	return SFP_OK;
+}
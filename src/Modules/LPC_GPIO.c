@@ -77,8 +77,90 @@ uint8_t const LPC_PIN_SECONDARY_FUNCTION[] = {
 		0x80 /* GPIO */, // 37
 };
 
-static volatile SFPFunctionType LPC_INTERRUPT_FUNCTION_TYPE[LPC_INTERRUPT_COUNT];
-static uint32_t LPC_INTERRUPT_DOWNTIME[LPC_INTERRUPT_COUNT];
+static volatile SFPFunctionType LPC_INTERRUPT_FUNCTION_TYPE[GPIO_EVENT_SOURCE_COUNT];
+static volatile GPIO_InterruptCallback LPC_INTERRUPT_HANDLER[LPC_INTERRUPT_COUNT];	// NULL - channel is free
+
+static volatile struct {
+	enum {
+		PULSE_IDLE=0,
+		PULSE_WAIT_IDLE,	// Waiting for the pulse in progress to end
+		PULSE_WAIT_START,	// Waiting for the pulse to start
+		PULSE_MEASURE,		// Pulse started
+		PULSE_DONE,			// All pulses measured
+	} status;
+
+	int8_t intID;
+	uint8_t port;
+	uint8_t pinNum;
+	uint8_t level;
+	SFPFunctionType type;
+
+	time_us_t requestTime;	// All times are Time_getAlarmTime() values
+	time_us_t timeout;
+	time_us_t startTime;
+
+	uint32_t count;			// Number of pulses requested
+	uint32_t measured;		// Number of pulses measured
+	uint32_t durations[LPC_PULSE_MAX_COUNT];
+} PulseHandler;
+
+/*
+ * Interrupt event queue. Events are pushed by the pin interrupt ISRs and sent
+ * from the main loop, so no SFP messages are built in the interrupt context.
+ */
+#define GPIO_EVENT_QUEUE_SIZE_N		4
+#define GPIO_EVENT_QUEUE_MASK		((1 << GPIO_EVENT_QUEUE_SIZE_N) - 1)
+#define GPIO_EVENT_BATCH_SIZE		8	// Events in a single coalesced message
+#define GPIO_EVENT_RECORD_SIZE		12	// Coalesced event on the wire
+
+static GPIO_Event GPIO_eventQueue[1 << GPIO_EVENT_QUEUE_SIZE_N];
+static volatile uint32_t GPIO_eventQueueWritePos;	// Written by the producer ISRs only
+static volatile uint32_t GPIO_eventQueueReadPos;	// Written by the main loop only
+static volatile uint32_t GPIO_eventsDropped;		// Written by the producer ISRs only
+static uint32_t GPIO_eventsDroppedReported;
+
+#define GPIO_eventQueueAvailable()	(GPIO_eventQueueWritePos - GPIO_eventQueueReadPos)
+
+/*
+ * Group interrupt reports. The ISR keeps the snapshot of the latest match and
+ * the number of matches since the last report, the main loop sends it.
+ */
+static LPC_GPIO_GROUP_INTx_Type * const LPC_GROUP_INTERRUPTS[LPC_GROUP_INTERRUPT_COUNT] = {
+		LPC_GPIO_GROUP_INT0, LPC_GPIO_GROUP_INT1
+};
+
+static volatile struct {
+	uint8_t pending;
+	uint16_t count;			// Matches since the last report
+	uint32_t port[2];		// Port values at the latest match
+	time_us_t time;			// Time_getAlarmTime() of the latest match
+	SFPFunctionType type;
+} GPIO_GroupEvents[LPC_GROUP_INTERRUPT_COUNT];
+
+/*
+ * attachInterrupt debounce. Deadlines of all channels share one CT32B1 alarm,
+ * which only marks the channel as expired and pends its pin interrupt, so the
+ * state below is handled at the pin interrupt priority (3) only.
+ */
+typedef struct {
+	uint8_t policy;			// GPIO_DEBOUNCE_x
+	uint8_t mode;			// attachInterrupt mode
+	uint8_t event;			// Event of the last edge (TRAILING)
+	uint8_t level;			// Last reported level (STABLE)
+	uint16_t count;			// Edges coalesced since the last report
+	uint32_t data;			// Interrupt pin values at the last edge (TRAILING)
+	time_us_t time;			// Time of the last edge (TRAILING)
+	time_us_t period;		// Debounce period in us, 0 - no debouncing
+	time_us_t deadline;
+} GPIO_DebounceState;
+
+static volatile GPIO_DebounceState GPIO_Debounce[LPC_INTERRUPT_COUNT];
+
+static volatile uint8_t GPIO_debounceActive;	// Channels waiting for their deadline
+static volatile uint8_t GPIO_debounceExpired;	// Channels with passed deadlines, not yet handled
+
+static void GPIO_InterruptHandler(uint8_t intID);
+static void GPIO_DebounceAlarm(void *param);
 
 void lpc_config_gpioInit() {
 	uint8_t pin;
@@ -328,19 +410,69 @@ SFPResult lpc_digitalRead(SFPFunction *msg) {
 	return SFP_OK;
 }
 
+static void GPIO_PulseHandler(uint8_t intID) {
+	time_us_t time = Time_getAlarmTime();
+	uint8_t intBit = (1 << intID);
+
+	uint8_t rise = (LPC_GPIO_PIN_INT->RISE & intBit) ? 1 : 0;
+	uint8_t fall = (LPC_GPIO_PIN_INT->FALL & intBit) ? 1 : 0;
+	LPC_GPIO_PIN_INT->RISE = intBit;	// Clear rising edge (sort of) flag
+	LPC_GPIO_PIN_INT->FALL = intBit;	// Clear falling edge (sort of) flag
+
+	uint8_t level = rise;
+	if (rise && fall)	// Both edges since the last call - the pin tells which one was the last
+		level = (LPC_GPIO->PIN[PulseHandler.port] & (1 << PulseHandler.pinNum)) ? 1 : 0;
+
+	switch (PulseHandler.status) {
+		case PULSE_WAIT_IDLE: {
+			if (level != PulseHandler.level)
+				PulseHandler.status = PULSE_WAIT_START;
+			break;
+		}
+		case PULSE_WAIT_START: {
+			if (level == PulseHandler.level) {
+				PulseHandler.startTime = time;
+				PulseHandler.status = PULSE_MEASURE;
+			}
+			break;
+		}
+		case PULSE_MEASURE: {
+			if (level != PulseHandler.level) {
+				PulseHandler.durations[PulseHandler.measured++] = time - PulseHandler.startTime;
+
+				if (PulseHandler.measured == PulseHandler.count)
+					PulseHandler.status = PULSE_DONE;
+				else
+					PulseHandler.status = PULSE_WAIT_START;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
 SFPResult lpc_pulseIn(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 3) return SFP_ERR_ARG_COUNT;
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 3 && argCount != 4) return SFP_ERR_ARG_COUNT;
 
 	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
 			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
-			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT)
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT
+			|| (argCount == 4 && SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT))
 		return SFP_ERR_ARG_TYPE;
 
 	uint8_t pin = SFPFunction_getArgument_int32(msg, 0);
-	uint8_t levelMask = (SFPFunction_getArgument_int32(msg, 1) == 0 ? 0 : 1);
+	uint8_t level = (SFPFunction_getArgument_int32(msg, 1) == 0 ? 0 : 1);
 	uint32_t timeout = SFPFunction_getArgument_int32(msg, 2);
+	uint32_t count = (argCount == 4 ? SFPFunction_getArgument_int32(msg, 3) : 1);	// Number of consecutive pulses
 
-	if (pin >= LPC_PIN_COUNT) return SFP_ERR_ARG_VALUE;
+	if (pin >= LPC_PIN_COUNT || count == 0 || count > LPC_PULSE_MAX_COUNT) return SFP_ERR_ARG_VALUE;
+
+	if (PulseHandler.status != PULSE_IDLE) return SFP_ERR_ARG_VALUE;	// Only one measurement at a time
+
+	int8_t intID = GPIO_AllocInterrupt(GPIO_PulseHandler);
+	if (intID < 0) return SFP_ERR_ARG_VALUE;	// All interrupt channels are in use
 
 	uint8_t port = 0;
 	uint8_t pinNum = LPC_PIN_IDS[pin];
@@ -349,105 +481,503 @@ SFPResult lpc_pulseIn(SFPFunction *msg) {
 		pinNum -= 24;
 	}
 
-	levelMask <<= pinNum; // shift BIT0 to pin place
+	PulseHandler.intID = intID;
+	PulseHandler.port = port;
+	PulseHandler.pinNum = pinNum;
+	PulseHandler.level = level;
+	PulseHandler.type = SFPFunction_getType(msg);
+	PulseHandler.count = count;
+	PulseHandler.measured = 0;
+	PulseHandler.timeout = timeout;
+	PulseHandler.requestTime = Time_getAlarmTime();
 
-	uint32_t startTimeUs = Time_getSystemTime_us();
-	uint32_t passedTimeUs = 0;
+	if (((LPC_GPIO->PIN[port] >> pinNum) & 1) == level)	// Skip the pulse which is already in progress
+		PulseHandler.status = PULSE_WAIT_IDLE;
+	else
+		PulseHandler.status = PULSE_WAIT_START;
 
-	while ((LPC_GPIO->PIN[port] & (1 << pinNum)) == levelMask) {	// Wait while signal is on
-		if ((passedTimeUs=Time_getSystemTime_us()-startTimeUs) >= timeout)
-			break;
+	GPIO_ConfigInterrupt(intID, pin, 2);	// Edge CHANGE mode, the result is sent by GPIO_Process
+
+	return SFP_OK;
+}
+
+/*
+ * Bit-banged shift register access. Pins are resolved to port masks once, so
+ * every clock edge is a single SET/CLR register write.
+ */
+typedef struct {
+	uint8_t dataPort, clockPort, latchPort;
+	uint32_t dataMask, clockMask, latchMask;	// latchMask = 0 - no latch pin
+	uint8_t msbFirst;
+	time_us_t halfPeriod;	// Half of the bit period in us, 0 - as fast as possible
+	time_us_t time;
+} GPIO_ShiftBus;
+
+static void GPIO_ShiftPin(uint8_t pin, uint8_t *port, uint32_t *mask) {
+	uint8_t pinNum = LPC_PIN_IDS[pin];
+
+	*port = 0;
+	if (pinNum > 23) {	// if not PIO0_0 to PIO0_23
+		*port = 1;
+		pinNum -= 24;
+	}
+	*mask = (1 << pinNum);
+}
+
+static inline void GPIO_ShiftWait(GPIO_ShiftBus *bus) {
+	if (bus->halfPeriod == 0) return;
+
+	bus->time += bus->halfPeriod;
+	while ((int32_t)(Time_getAlarmTime() - bus->time) < 0);
+}
+
+/*
+ * Common arguments: (dataPin, clockPin, bitOrder, x[, latchPin[, bitPeriod]])
+ * bitOrder: 0 - LSB first, 1 - MSB first; bitPeriod in us.
+ */
+static SFPResult GPIO_ShiftParse(SFPFunction *msg, SFPArgumentType xType, GPIO_ShiftBus *bus) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount < 4 || argCount > 6) return SFP_ERR_ARG_COUNT;
+
+	uint32_t i;
+	for (i=0; i<argCount; i++) {
+		if (SFPFunction_getArgumentType(msg, i) != (i == 3 ? xType : SFP_ARG_INT))
+			return SFP_ERR_ARG_TYPE;
 	}
 
-	while ((LPC_GPIO->PIN[port] & (1 << pinNum)) != levelMask) { // Wait while signal is off
-		if ((passedTimeUs=Time_getSystemTime_us()-startTimeUs) >= timeout)
-			break;
+	uint8_t p_data = SFPFunction_getArgument_int32(msg, 0);
+	uint8_t p_clock = SFPFunction_getArgument_int32(msg, 1);
+	uint8_t p_order = SFPFunction_getArgument_int32(msg, 2);
+	uint8_t p_latch = (argCount > 4 ? SFPFunction_getArgument_int32(msg, 4) : 0xFF);	// 0xFF - no latch pin
+	uint32_t p_period = (argCount > 5 ? SFPFunction_getArgument_int32(msg, 5) : 0);
+
+	if (p_data >= LPC_PIN_COUNT || p_clock >= LPC_PIN_COUNT || p_order > 1
+			|| (p_latch >= LPC_PIN_COUNT && p_latch != 0xFF))
+		return SFP_ERR_ARG_VALUE;
+
+	GPIO_ShiftPin(p_data, &bus->dataPort, &bus->dataMask);
+	GPIO_ShiftPin(p_clock, &bus->clockPort, &bus->clockMask);
+	if (p_latch != 0xFF)
+		GPIO_ShiftPin(p_latch, &bus->latchPort, &bus->latchMask);
+	else
+		bus->latchMask = 0;
+
+	bus->msbFirst = p_order;
+	bus->halfPeriod = (p_period + 1) / 2;
+	bus->time = Time_getAlarmTime();
+
+	return SFP_OK;
+}
+
+SFPResult lpc_shiftOut(SFPFunction *msg) {
+	GPIO_ShiftBus bus;
+	SFPResult res = GPIO_ShiftParse(msg, SFP_ARG_BYTE_ARRAY, &bus);
+	if (res != SFP_OK) return res;
+
+	uint32_t size, i;
+	uint8_t *data = SFPFunction_getArgument_barray(msg, 3, &size);
+
+	volatile uint32_t *dataSet = &LPC_GPIO->SET[bus.dataPort];
+	volatile uint32_t *dataClr = &LPC_GPIO->CLR[bus.dataPort];
+	volatile uint32_t *clockSet = &LPC_GPIO->SET[bus.clockPort];
+	volatile uint32_t *clockClr = &LPC_GPIO->CLR[bus.clockPort];
+
+	*clockClr = bus.clockMask;	// Data is sampled on the rising clock edge (74HC595)
+	if (bus.latchMask)
+		LPC_GPIO->CLR[bus.latchPort] = bus.latchMask;
+
+	for (i=0; i<size; i++) {
+		uint8_t value = data[i];
+		uint8_t bit;
+
+		for (bit=0; bit<8; bit++) {
+			uint8_t out;
+			if (bus.msbFirst) {
+				out = value & 0x80;
+				value <<= 1;
+			} else {
+				out = value & 0x01;
+				value >>= 1;
+			}
+
+			if (out)
+				*dataSet = bus.dataMask;
+			else
+				*dataClr = bus.dataMask;
+
+			GPIO_ShiftWait(&bus);
+			*clockSet = bus.clockMask;
+			GPIO_ShiftWait(&bus);
+			*clockClr = bus.clockMask;
+		}
 	}
 
-	uint32_t signalStartTime = Time_getSystemTime_us();
+	if (bus.latchMask) {	// Rising latch edge moves the data to the outputs
+		GPIO_ShiftWait(&bus);
+		LPC_GPIO->SET[bus.latchPort] = bus.latchMask;
+	}
 
-	while ((LPC_GPIO->PIN[port] & (1 << pinNum)) == levelMask) {	// Wait while signal is on
-		if ((passedTimeUs=Time_getSystemTime_us()-startTimeUs) >= timeout)
-			break;
+	return SFP_OK;
+}
+
+SFPResult lpc_shiftIn(SFPFunction *msg) {
+	GPIO_ShiftBus bus;
+	SFPResult res = GPIO_ShiftParse(msg, SFP_ARG_INT, &bus);
+	if (res != SFP_OK) return res;
+
+	uint32_t size = SFPFunction_getArgument_int32(msg, 3), i;	// Number of bytes to read
+	if (size == 0) return SFP_ERR_ARG_VALUE;
+
+	uint8_t *data = MemoryManager_malloc(size);
+	if (data == NULL)
+		return SFP_ERR_ALLOC_FAILED;
+
+	volatile uint32_t *dataPin = &LPC_GPIO->PIN[bus.dataPort];
+	volatile uint32_t *clockSet = &LPC_GPIO->SET[bus.clockPort];
+	volatile uint32_t *clockClr = &LPC_GPIO->CLR[bus.clockPort];
+
+	*clockClr = bus.clockMask;
+	if (bus.latchMask) {	// Low latch pulse loads the parallel inputs (74HC165 SH/LD)
+		LPC_GPIO->CLR[bus.latchPort] = bus.latchMask;
+		GPIO_ShiftWait(&bus);
+		LPC_GPIO->SET[bus.latchPort] = bus.latchMask;
+		GPIO_ShiftWait(&bus);
+	}
+
+	for (i=0; i<size; i++) {
+		uint8_t value = 0;
+		uint8_t bit;
+
+		for (bit=0; bit<8; bit++) {	// The bit is read before the clock edge shifting in the next one
+			uint8_t in = (*dataPin & bus.dataMask) ? 1 : 0;
+
+			if (bus.msbFirst)
+				value = (value << 1) | in;
+			else
+				value |= (in << bit);
+
+			*clockSet = bus.clockMask;
+			GPIO_ShiftWait(&bus);
+			*clockClr = bus.clockMask;
+			GPIO_ShiftWait(&bus);
+		}
+
+		data[i] = value;
 	}
-	uint32_t signalDuration = Time_getSystemTime_us()-signalStartTime;
 
 	SFPFunction *outFunc = SFPFunction_new();
 
-	if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+	if (outFunc == NULL) {
+		MemoryManager_free(data);
+		return SFP_ERR_ALLOC_FAILED;
+	}
 
 	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+	SFPFunction_setID(outFunc, UPER_FID_SHIFTIN);
+	SFPFunction_setName(outFunc, UPER_FNAME_SHIFTIN);
+	SFPFunction_addArgument_barray(outFunc, data, size);
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	MemoryManager_free(data);
+
+	return SFP_OK;
+}
+
+static void GPIO_SendPulses(void) {
+	SFPFunction *outFunc = SFPFunction_new();
+	if (outFunc == NULL) return;
+
+	SFPFunction_setType(outFunc, PulseHandler.type);
 	SFPFunction_setID(outFunc, UPER_FID_PULSEIN);
 	SFPFunction_setName(outFunc, UPER_FNAME_PULSEIN);
-	SFPFunction_addArgument_int32(outFunc, (passedTimeUs < timeout ? signalDuration : 0));
+
+	uint32_t i;
+	for (i=0; i<PulseHandler.count; i++)	// Pulses not measured before the timeout are reported as 0
+		SFPFunction_addArgument_int32(outFunc, (i < PulseHandler.measured ? PulseHandler.durations[i] : 0));
+
 	SFPFunction_send(outFunc, &stream);
 	SFPFunction_delete(outFunc);
+}
 
-	return SFP_OK;
+static uint8_t GPIO_QueueEvent(uint8_t source, uint8_t event, uint16_t count, uint32_t data, time_us_t time) {
+	uint32_t writePos = GPIO_eventQueueWritePos;
+
+	if (writePos - GPIO_eventQueueReadPos > GPIO_EVENT_QUEUE_MASK) {	// Queue is full
+		GPIO_eventsDropped++;
+		return 0;
+	}
+
+	GPIO_Event *ev = &GPIO_eventQueue[writePos & GPIO_EVENT_QUEUE_MASK];
+	ev->source = source;
+	ev->event = event;
+	ev->count = count;
+	ev->data = data;
+	ev->time = time;
+
+	GPIO_eventQueueWritePos = writePos + 1;	// Publish the event
+
+	return 1;
 }
 
-SFPResult lpc_attachInterrupt(SFPFunction *func) {
-	if (SFPFunction_getArgumentCount(func) != 4)
-		return SFP_ERR_ARG_COUNT;
+uint8_t GPIO_PushEvent(uint8_t source, uint8_t event, uint32_t data) {
+	return GPIO_QueueEvent(source, event, 1, data, Time_getAlarmTime());
+}
 
-	if (SFPFunction_getArgumentType(func, 0) != SFP_ARG_INT
-			|| SFPFunction_getArgumentType(func, 1) != SFP_ARG_INT
-			|| SFPFunction_getArgumentType(func, 2) != SFP_ARG_INT
-			|| SFPFunction_getArgumentType(func, 3) != SFP_ARG_INT)
-		return SFP_ERR_ARG_TYPE;
+void GPIO_SetEventType(uint8_t source, SFPFunctionType type) {
+	if (source >= LPC_INTERRUPT_COUNT && source < GPIO_EVENT_SOURCE_COUNT)
+		LPC_INTERRUPT_FUNCTION_TYPE[source] = type;
+}
 
-	uint8_t p_intID = SFPFunction_getArgument_int32(func, 0);	// interrupt ID
-	uint8_t p_pin = SFPFunction_getArgument_int32(func, 1);	// pin ID
-	uint8_t p_mode = SFPFunction_getArgument_int32(func, 2);	// interrupt mode
-	uint32_t p_downtime = SFPFunction_getArgument_int32(func, 3); // down time
+static inline SFPFunctionType GPIO_EventType(GPIO_Event *ev) {
+	return LPC_INTERRUPT_FUNCTION_TYPE[ev->source];
+}
 
-	if (p_pin >= LPC_PIN_COUNT || p_intID >= LPC_INTERRUPT_COUNT || p_mode > 4) return SFP_ERR_ARG_VALUE;
+static void GPIO_SendEvents(void) {
+	uint32_t available = GPIO_eventQueueAvailable();
+	uint32_t dropped = GPIO_eventsDropped - GPIO_eventsDroppedReported;
 
-	NVIC_DisableIRQ(p_intID);	// Disable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
+	if (available == 0 && dropped == 0)
+		return;
 
-	LPC_SYSCON->PINTSEL[p_intID] = LPC_PIN_IDS[p_pin]; 	// select which pin will cause the interrupts
+	SFPFunction *func = SFPFunction_new();
+	if (func == NULL) return;
+
+	SFPFunction_setID(func, UPER_FID_INTERRUPT);
+	SFPFunction_setName(func, UPER_FNAME_INTERRUPT);
+
+	if (available == 1 && dropped == 0) {	// Single event: interrupt(intID, (values << 8) | event, time[, count])
+		GPIO_Event *ev = &GPIO_eventQueue[GPIO_eventQueueReadPos & GPIO_EVENT_QUEUE_MASK];
+
+		SFPFunction_setType(func, GPIO_EventType(ev));
+		SFPFunction_addArgument_int32(func, ev->source);
+		SFPFunction_addArgument_int32(func, (ev->data << 8) | ev->event);
+		SFPFunction_addArgument_int32(func, ev->time);
+		if (ev->count != 1)	// Coalesced (debounced) edges
+			SFPFunction_addArgument_int32(func, ev->count);
+	} else {	// Backlog: interrupt(records, dropped)
+		uint8_t records[GPIO_EVENT_BATCH_SIZE*GPIO_EVENT_RECORD_SIZE];
+		uint8_t *ptr = records;
+		uint32_t i;
+
+		if (available > GPIO_EVENT_BATCH_SIZE)
+			available = GPIO_EVENT_BATCH_SIZE;
+
+		SFPFunction_setType(func, GPIO_EventType(&GPIO_eventQueue[GPIO_eventQueueReadPos & GPIO_EVENT_QUEUE_MASK]));
+
+		for (i=0; i<available; i++) {
+			GPIO_Event *ev = &GPIO_eventQueue[(GPIO_eventQueueReadPos + i) & GPIO_EVENT_QUEUE_MASK];
+
+			*ptr++ = ev->source;
+			*ptr++ = ev->event;
+			*ptr++ = ev->count;
+			*ptr++ = ev->count >> 8;
+			*ptr++ = ev->data;
+			*ptr++ = ev->data >> 8;
+			*ptr++ = ev->data >> 16;
+			*ptr++ = ev->data >> 24;
+			*ptr++ = ev->time;
+			*ptr++ = ev->time >> 8;
+			*ptr++ = ev->time >> 16;
+			*ptr++ = ev->time >> 24;
+		}
+
+		SFPFunction_addArgument_barray(func, records, ptr - records);
+		SFPFunction_addArgument_int32(func, dropped);
+		GPIO_eventsDroppedReported += dropped;
+	}
+
+	GPIO_eventQueueReadPos += available;	// Release the sent events
+
+	SFPFunction_send(func, &stream);
+	SFPFunction_delete(func);
+}
+
+static void GPIO_SendGroupEvent(uint8_t group) {
+	uint8_t values[LPC_PIN_COUNT];
+	uint32_t port[2];
+	uint32_t count;
+	time_us_t time;
+	uint8_t pin;
+
+	NVIC_DisableIRQ(GINT0_IRQn + group);	// Take the snapshot atomically
+	port[0] = GPIO_GroupEvents[group].port[0];
+	port[1] = GPIO_GroupEvents[group].port[1];
+	time = GPIO_GroupEvents[group].time;
+	count = GPIO_GroupEvents[group].count;
+	GPIO_GroupEvents[group].count = 0;
+	GPIO_GroupEvents[group].pending = 0;
+	NVIC_EnableIRQ(GINT0_IRQn + group);
+
+	for (pin=0; pin<LPC_PIN_COUNT; pin++) {
+		uint8_t pinNum = LPC_PIN_IDS[pin];
+
+		if (pinNum > 23)	// if not PIO0_0 to PIO0_23
+			values[pin] = (port[1] >> (pinNum - 24)) & 1;
+		else
+			values[pin] = (port[0] >> pinNum) & 1;
+	}
+
+	SFPFunction *func = SFPFunction_new();
+	if (func == NULL) return;
+
+	SFPFunction_setType(func, GPIO_GroupEvents[group].type);
+	SFPFunction_setID(func, UPER_FID_GROUPINTERRUPT);
+	SFPFunction_setName(func, UPER_FNAME_GROUPINTERRUPT);
+	SFPFunction_addArgument_int32(func, group);
+	SFPFunction_addArgument_barray(func, values, LPC_PIN_COUNT);
+	SFPFunction_addArgument_int32(func, time);
+	SFPFunction_addArgument_int32(func, count);
+	SFPFunction_send(func, &stream);
+	SFPFunction_delete(func);
+}
+
+void GPIO_Process(void) {
+	GPIO_SendEvents();
+
+	uint8_t group;
+	for (group=0; group<LPC_GROUP_INTERRUPT_COUNT; group++) {
+		if (GPIO_GroupEvents[group].pending)
+			GPIO_SendGroupEvent(group);
+	}
+
+	if (PulseHandler.status != PULSE_IDLE) {
+		if (PulseHandler.status == PULSE_DONE
+				|| (Time_getAlarmTime() - PulseHandler.requestTime) >= PulseHandler.timeout) {
+			GPIO_FreeInterrupt(PulseHandler.intID);
+			GPIO_SendPulses();
+			PulseHandler.status = PULSE_IDLE;
+		}
+	}
+}
+
+int8_t GPIO_AllocInterrupt(GPIO_InterruptCallback handler) {
+	int8_t intID;
+	for (intID=LPC_INTERRUPT_COUNT-1; intID>=0; intID--) {	// attachInterrupt users usually start from 0
+		if (LPC_INTERRUPT_HANDLER[intID] == NULL) {
+			LPC_INTERRUPT_HANDLER[intID] = handler;
+			return intID;
+		}
+	}
+
+	return -1;
+}
+
+void GPIO_ConfigInterrupt(uint8_t intID, uint8_t pin, uint8_t mode) {
+	NVIC_DisableIRQ(intID);	// Disable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
+
+	LPC_SYSCON->PINTSEL[intID] = LPC_PIN_IDS[pin]; 	// select which pin will cause the interrupts
 
 	// XXX: using SI/CI ENF and ENR registers could probably save few instructions
-	switch (p_mode) {
+	switch (mode) {
 		case 0: {	// LOW level mode
-			LPC_GPIO_PIN_INT ->ISEL |= (1 << p_intID);	// Set PMODE=level sensitive
-			LPC_GPIO_PIN_INT ->IENR |= (1 << p_intID);	// Enable level interrupt.
-			LPC_GPIO_PIN_INT ->IENF &= ~(1 << p_intID);	// Set active level LOW.
+			LPC_GPIO_PIN_INT ->ISEL |= (1 << intID);	// Set PMODE=level sensitive
+			LPC_GPIO_PIN_INT ->IENR |= (1 << intID);	// Enable level interrupt.
+			LPC_GPIO_PIN_INT ->IENF &= ~(1 << intID);	// Set active level LOW.
 			break;
 		}
 		case 1: {	// HIGH level mode
-			LPC_GPIO_PIN_INT ->ISEL |= (1 << p_intID);	// Set PMODE=level sensitive
-			LPC_GPIO_PIN_INT ->IENR |= (1 << p_intID);	// Enable level interrupt.
-			LPC_GPIO_PIN_INT ->IENF |= (1 << p_intID);	// Set active level HIGH.
+			LPC_GPIO_PIN_INT ->ISEL |= (1 << intID);	// Set PMODE=level sensitive
+			LPC_GPIO_PIN_INT ->IENR |= (1 << intID);	// Enable level interrupt.
+			LPC_GPIO_PIN_INT ->IENF |= (1 << intID);	// Set active level HIGH.
 			break;
 		}
 		case 2: {	// Edge CHANGE mode
-			LPC_GPIO_PIN_INT ->ISEL &= ~(1 << p_intID);	// Set PMODE=edge sensitive
-			LPC_GPIO_PIN_INT ->IENR |= (1 << p_intID);	// Enable rising edge.
-			LPC_GPIO_PIN_INT ->IENF |= (1 << p_intID);	// Enable falling edge.
+			LPC_GPIO_PIN_INT ->ISEL &= ~(1 << intID);	// Set PMODE=edge sensitive
+			LPC_GPIO_PIN_INT ->IENR |= (1 << intID);	// Enable rising edge.
+			LPC_GPIO_PIN_INT ->IENF |= (1 << intID);	// Enable falling edge.
 			break;
 		}
 		case 3: {	// RISING edge mode
-			LPC_GPIO_PIN_INT ->ISEL &= ~(1 << p_intID);	// Set PMODE=edge sensitive
-			LPC_GPIO_PIN_INT ->IENR |= (1 << p_intID);	// Enable rising edge.
-			LPC_GPIO_PIN_INT ->IENF &= ~(1 << p_intID);	// Disable falling edge.
+			LPC_GPIO_PIN_INT ->ISEL &= ~(1 << intID);	// Set PMODE=edge sensitive
+			LPC_GPIO_PIN_INT ->IENR |= (1 << intID);	// Enable rising edge.
+			LPC_GPIO_PIN_INT ->IENF &= ~(1 << intID);	// Disable falling edge.
 			break;
 		}
 		case 4: {	// FALLING edge mode
-			LPC_GPIO_PIN_INT ->ISEL &= ~(1 << p_intID);	// Set PMODE=edge sensitive
-			LPC_GPIO_PIN_INT ->IENR &= ~(1 << p_intID);	// Disable rising edge.
-			LPC_GPIO_PIN_INT ->IENF |= (1 << p_intID);	// Enable falling edge.
+			LPC_GPIO_PIN_INT ->ISEL &= ~(1 << intID);	// Set PMODE=edge sensitive
+			LPC_GPIO_PIN_INT ->IENR &= ~(1 << intID);	// Disable rising edge.
+			LPC_GPIO_PIN_INT ->IENF |= (1 << intID);	// Enable falling edge.
 			break;
 		}
 	}
 
+	LPC_GPIO_PIN_INT->RISE = (1 << intID);	// Clear rising edge (sort of) flag
+	LPC_GPIO_PIN_INT->FALL = (1 << intID);	// Clear falling edge (sort of) flag
+	NVIC_SetPriority(intID, 3); // set lowest priority
+	NVIC_EnableIRQ(intID);	// Enable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
+}
+
+void GPIO_FreeInterrupt(uint8_t intID) {
+	NVIC_DisableIRQ(intID);	// Disable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
+	LPC_GPIO_PIN_INT->CIENR = (1 << intID);	// Disable rising edge or level interrupt
+	LPC_GPIO_PIN_INT->CIENF = (1 << intID);	// Disable falling edge interrupt
+	LPC_GPIO_PIN_INT->RISE = (1 << intID);	// Clear rising edge (sort of) flag
+	LPC_GPIO_PIN_INT->FALL = (1 << intID);	// Clear falling edge (sort of) flag
+
+	__disable_irq();	// Make sure the debounce alarm won't touch the channel anymore
+	GPIO_debounceActive &= ~(1 << intID);
+	GPIO_debounceExpired &= ~(1 << intID);
+	__enable_irq();
+
+	LPC_INTERRUPT_HANDLER[intID] = NULL;
+}
+
+SFPResult lpc_attachInterrupt(SFPFunction *func) {
+	uint32_t argCount = SFPFunction_getArgumentCount(func);
+	if (argCount != 4 && argCount != 5)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(func, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(func, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(func, 2) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(func, 3) != SFP_ARG_INT
+			|| (argCount == 5 && SFPFunction_getArgumentType(func, 4) != SFP_ARG_INT))
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_intID = SFPFunction_getArgument_int32(func, 0);	// interrupt ID
+	uint8_t p_pin = SFPFunction_getArgument_int32(func, 1);	// pin ID
+	uint8_t p_mode = SFPFunction_getArgument_int32(func, 2);	// interrupt mode
+	uint32_t p_downtime = SFPFunction_getArgument_int32(func, 3); // down time: ms, or us if the policy is given
+	uint8_t p_policy = GPIO_DEBOUNCE_LEADING;
+
+	if (argCount == 5) {
+		p_policy = SFPFunction_getArgument_int32(func, 4);	// debounce policy
+		if (p_downtime > 0x7FFFFFFF) return SFP_ERR_ARG_VALUE;	// Deadlines are compared as int32_t
+	} else {
+		if (p_downtime > 0x7FFFFFFF / 1000) return SFP_ERR_ARG_VALUE;
+		p_downtime *= 1000;
+	}
+
+	if (p_pin >= LPC_PIN_COUNT || p_intID >= LPC_INTERRUPT_COUNT || p_mode > 4 || p_policy > GPIO_DEBOUNCE_STABLE)
+		return SFP_ERR_ARG_VALUE;
+
+	if (p_mode < 2 && p_policy != GPIO_DEBOUNCE_LEADING) return SFP_ERR_ARG_VALUE;	// Level modes have no edges to wait for
+
+	GPIO_InterruptCallback handler = LPC_INTERRUPT_HANDLER[p_intID];
+	if (handler != NULL && handler != GPIO_InterruptHandler) return SFP_ERR_ARG_VALUE;	// Channel is used by another function
+
+	NVIC_DisableIRQ(p_intID);	// Disable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
+
+	__disable_irq();
+	GPIO_debounceActive &= ~(1 << p_intID);
+	GPIO_debounceExpired &= ~(1 << p_intID);
+	__enable_irq();
+
+	uint8_t pinNum = LPC_PIN_IDS[p_pin];
+	uint8_t port = (pinNum > 23 ? 1 : 0);	// if not PIO0_0 to PIO0_23
+	if (port) pinNum -= 24;
+
+	GPIO_Debounce[p_intID].policy = p_policy;
+	GPIO_Debounce[p_intID].mode = p_mode;
+	GPIO_Debounce[p_intID].level = (LPC_GPIO->PIN[port] >> pinNum) & 1;
+	GPIO_Debounce[p_intID].count = 0;
+	GPIO_Debounce[p_intID].period = p_downtime;
+
+	LPC_INTERRUPT_HANDLER[p_intID] = GPIO_InterruptHandler;
 	LPC_INTERRUPT_FUNCTION_TYPE[p_intID] = SFPFunction_getType(func);
-	LPC_INTERRUPT_DOWNTIME[p_intID] = p_downtime;
 
-	LPC_GPIO_PIN_INT->RISE = (1 << p_intID);	// Clear rising edge (sort of) flag
-	LPC_GPIO_PIN_INT->FALL = (1 << p_intID);	// Clear falling edge (sort of) flag
-	NVIC_SetPriority(p_intID, 3); // set lowest priority
-	NVIC_EnableIRQ(p_intID);	// Enable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
+	GPIO_ConfigInterrupt(p_intID, p_pin, p_mode);
 
 	return SFP_OK;
 }
@@ -460,17 +990,116 @@ SFPResult lpc_detachInterrupt(SFPFunction *msg) {
 
 	uint8_t p_intID = SFPFunction_getArgument_int32(msg, 0);	// interrupt ID
 
-	NVIC_DisableIRQ(p_intID);	// Disable interrupt. XXX: Luckily FLEX_INTx_IRQn == x, so it can be used this way, otherwise BE AWARE!
-	LPC_GPIO_PIN_INT->CIENR = (1 << p_intID);	// Disable rising edge or level interrupt
-	LPC_GPIO_PIN_INT->CIENF = (1 << p_intID);	// Disable falling edge interrupt
-	LPC_GPIO_PIN_INT->RISE = (1 << p_intID);	// Clear rising edge (sort of) flag
-	LPC_GPIO_PIN_INT->FALL = (1 << p_intID);	// Clear falling edge (sort of) flag
+	if (p_intID >= LPC_INTERRUPT_COUNT) return SFP_ERR_ARG_VALUE;
+
+	GPIO_InterruptCallback handler = LPC_INTERRUPT_HANDLER[p_intID];
+	if (handler != NULL && handler != GPIO_InterruptHandler) return SFP_ERR_ARG_VALUE;	// Channel is used by another function
+
+	GPIO_FreeInterrupt(p_intID);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_attachGroupInterrupt(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 4)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_BYTE_ARRAY
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_BYTE_ARRAY
+			|| SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint32_t pinCount, levelCount, i;
+	uint8_t p_group = SFPFunction_getArgument_int32(msg, 0);	// GINT0 or GINT1
+	uint8_t *p_pins = SFPFunction_getArgument_barray(msg, 1, &pinCount);
+	uint8_t *p_levels = SFPFunction_getArgument_barray(msg, 2, &levelCount);	// Level matching for every pin
+	uint8_t p_mode = SFPFunction_getArgument_int32(msg, 3);	// 0 - any pin matches (OR), 1 - all pins match (AND)
+
+	if (p_group >= LPC_GROUP_INTERRUPT_COUNT || pinCount == 0 || pinCount != levelCount || p_mode > 1)
+		return SFP_ERR_ARG_VALUE;
+
+	for (i=0; i<pinCount; i++) {  // Check argument values before any changes
+		if (p_pins[i] >= LPC_PIN_COUNT)
+			return SFP_ERR_ARG_VALUE;
+	}
+
+	uint32_t enable[2] = { 0, 0 };
+	uint32_t polarity[2] = { 0, 0 };
+
+	for (i=0; i<pinCount; i++) {
+		uint8_t port = 0;
+		uint8_t pinNum = LPC_PIN_IDS[p_pins[i]];
+		if (pinNum > 23) {	// if not PIO0_0 to PIO0_23
+			port = 1;
+			pinNum -= 24;
+		}
+
+		enable[port] |= (1 << pinNum);
+		if (p_levels[i])
+			polarity[port] |= (1 << pinNum);
+	}
+
+	LPC_GPIO_GROUP_INTx_Type *gint = LPC_GROUP_INTERRUPTS[p_group];
+
+	NVIC_DisableIRQ(GINT0_IRQn + p_group);
+
+	gint->PORT_ENA[0] = 0;	// Disable the group while it's being changed
+	gint->PORT_ENA[1] = 0;
+	gint->PORT_POL[0] = polarity[0];
+	gint->PORT_POL[1] = polarity[1];
+	gint->CTRL = BIT0 | (p_mode << 1);	// Clear interrupt, edge triggered, OR/AND combination
+	gint->PORT_ENA[0] = enable[0];
+	gint->PORT_ENA[1] = enable[1];
+
+	GPIO_GroupEvents[p_group].pending = 0;
+	GPIO_GroupEvents[p_group].count = 0;
+	GPIO_GroupEvents[p_group].type = SFPFunction_getType(msg);
+
+	NVIC_SetPriority(GINT0_IRQn + p_group, 3); // set lowest priority
+	NVIC_EnableIRQ(GINT0_IRQn + p_group);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_detachGroupInterrupt(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT) return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_group = SFPFunction_getArgument_int32(msg, 0);
+
+	if (p_group >= LPC_GROUP_INTERRUPT_COUNT) return SFP_ERR_ARG_VALUE;
+
+	LPC_GPIO_GROUP_INTx_Type *gint = LPC_GROUP_INTERRUPTS[p_group];
+
+	NVIC_DisableIRQ(GINT0_IRQn + p_group);
+	gint->PORT_ENA[0] = 0;
+	gint->PORT_ENA[1] = 0;
+	gint->CTRL = BIT0;	// Clear interrupt
+
+	GPIO_GroupEvents[p_group].pending = 0;
 
 	return SFP_OK;
 }
 
-void GPIO_EnableInterruptCallback(void* ptr) {
-	GPIO_EnableInterrupt((uint8_t)(uint32_t)ptr);
+static void GPIO_GroupInterruptHandler(uint8_t group) {
+	GPIO_GroupEvents[group].port[0] = LPC_GPIO->PIN[0];
+	GPIO_GroupEvents[group].port[1] = LPC_GPIO->PIN[1];
+	GPIO_GroupEvents[group].time = Time_getAlarmTime();
+	GPIO_GroupEvents[group].count++;
+	GPIO_GroupEvents[group].pending = 1;
+
+	LPC_GROUP_INTERRUPTS[group]->CTRL |= BIT0;	// Clear interrupt
+}
+
+void GINT0_IRQHandler() {
+	GPIO_GroupInterruptHandler(0);
+}
+
+void GINT1_IRQHandler() {
+	GPIO_GroupInterruptHandler(1);
 }
 
 void GPIO_EnableInterrupt(uint8_t intID) {
@@ -479,100 +1108,235 @@ void GPIO_EnableInterrupt(uint8_t intID) {
 	NVIC_EnableIRQ(intID);	// Enable ISR
 }
 
-static inline void GPIO_SEND_INT(uint8_t intID, uint32_t intStatus) {
-	SFPFunction *func = SFPFunction_new();
-	if (func != NULL) {
-		SFPFunction_setType(func, LPC_INTERRUPT_FUNCTION_TYPE[intID]);
-		SFPFunction_setID(func, UPER_FID_INTERRUPT);
-		SFPFunction_setName(func, UPER_FNAME_INTERRUPT);
-		SFPFunction_addArgument_int32(func, intID);
-		SFPFunction_addArgument_int32(func, intStatus);
-		SFPFunction_send(func, &stream);
-		SFPFunction_delete(func);
+static void GPIO_DebounceSchedule(void) {
+	time_us_t now = Time_getAlarmTime();
+	time_us_t next = 0;
+	uint32_t nextDelay = 0xFFFFFFFF;
+	uint8_t i;
+
+	__disable_irq();
+	uint8_t active = GPIO_debounceActive;
+	for (i=0; i<LPC_INTERRUPT_COUNT; i++) {
+		if ((active & (1 << i)) == 0) continue;
+
+		int32_t delay = GPIO_Debounce[i].deadline - now;
+		if (delay < 0) delay = 0;
+
+		if ((uint32_t)delay < nextDelay) {
+			nextDelay = delay;
+			next = GPIO_Debounce[i].deadline;
+		}
 	}
+	__enable_irq();
+
+	// The alarm ISR only removes deadlines, so a stale (earlier) alarm is harmless
+	if (active == 0)
+		Time_clearAlarm(TIME_ALARM_DEBOUNCE);
+	else
+		Time_setAlarm(TIME_ALARM_DEBOUNCE, next, GPIO_DebounceAlarm, NULL);
 }
 
-static void GPIO_InterruptHandler(uint8_t intID) {
-	NVIC_DisableIRQ(intID);		// Disable ISR
+static void GPIO_DebounceAlarm(void *param) {
+	time_us_t now = Time_getAlarmTime();
+	uint8_t i;
 
-	uint8_t intBit = (1 << intID);
+	for (i=0; i<LPC_INTERRUPT_COUNT; i++) {
+		uint8_t intBit = (1 << i);
 
-	if (LPC_GPIO_PIN_INT->IST & intBit) {
+		__disable_irq();
+		if ((GPIO_debounceActive & intBit) && (int32_t)(now - GPIO_Debounce[i].deadline) >= 0) {
+			GPIO_debounceActive &= ~intBit;
+			GPIO_debounceExpired |= intBit;
+			NVIC_SetPendingIRQ(i);	// The pin interrupt handles the expiry
+			NVIC_EnableIRQ(i);
+		}
+		__enable_irq();
+	}
 
-		uint32_t interruptValues = 0;
-		uint8_t i;
-		for (i=0; i<LPC_INTERRUPT_COUNT; i++) {
-			uint8_t port = 0;
-			uint8_t pinNum = LPC_SYSCON->PINTSEL[i];
-			if (pinNum > 23) {
-				port = 1;
-				pinNum -= 24;
-			}
+	GPIO_DebounceSchedule();
+}
 
-			if (LPC_GPIO->PIN[port] & (1 << pinNum))
-				interruptValues |= (1 << i);
+static void GPIO_DebounceStart(uint8_t intID, time_us_t now) {
+	__disable_irq();
+	GPIO_Debounce[intID].deadline = now + GPIO_Debounce[intID].period;
+	GPIO_debounceActive |= (1 << intID);
+	__enable_irq();
+
+	GPIO_DebounceSchedule();
+}
+
+static uint32_t GPIO_InterruptValues(void) {
+	uint32_t portValues[2] = { LPC_GPIO->PIN[0], LPC_GPIO->PIN[1] };	// Sample both ports once
+	uint32_t interruptValues = 0;
+	uint8_t i;
+	for (i=0; i<LPC_INTERRUPT_COUNT; i++) {
+		uint8_t port = 0;
+		uint8_t pinNum = LPC_SYSCON->PINTSEL[i];
+		if (pinNum > 23) {
+			port = 1;
+			pinNum -= 24;
 		}
 
+		if (portValues[port] & (1 << pinNum))
+			interruptValues |= (1 << i);
+	}
 
-		uint8_t interruptEvent = 0xFF;
+	return interruptValues;
+}
 
-		if ((LPC_GPIO_PIN_INT->ISEL & intBit)) {	// if LEVEL mode
-			if (LPC_GPIO_PIN_INT->IENR & intBit) {	// if LEVEL interrupts are enabled
-				if (LPC_GPIO_PIN_INT->IENF & intBit) {	// HIGH mode
-					interruptEvent = 1;
-				} else {								// LOW mode
-					interruptEvent = 0;
-				}
-			}
-		} else {	// EDGE mode
-			if ((LPC_GPIO_PIN_INT->RISE & intBit) && (LPC_GPIO_PIN_INT->IENR & intBit)) {	// Rising edge interrupt
-				interruptEvent = 3;
+static void GPIO_DebounceExpire(uint8_t intID) {
+	volatile GPIO_DebounceState *db = &GPIO_Debounce[intID];
+
+	switch (db->policy) {
+		case GPIO_DEBOUNCE_TRAILING: {
+			if (db->count == 0) break;
+
+			GPIO_QueueEvent(intID, db->event, db->count, db->data, db->time);
+			db->count = 0;
+			break;
+		}
+		case GPIO_DEBOUNCE_STABLE: {
+			uint32_t values = GPIO_InterruptValues();
+			uint8_t level = (values >> intID) & 1;
+
+			if (level == db->level) break;	// Just a glitch, keep counting the edges
+			db->level = level;
+
+			if ((db->mode == 3 && level == 0) || (db->mode == 4 && level == 1)) {
+				db->count = 0;	// The other edge is not reported, but it resets the count
+				break;
 			}
-			if ((LPC_GPIO_PIN_INT->FALL & intBit) && (LPC_GPIO_PIN_INT->IENF & intBit)) {	// Falling edge interrupt
-				if (interruptEvent == 3)
-					interruptEvent = 2;				// Edge CHANGE (RISE+FALL)
-				else
-					interruptEvent = 4;				// Falling edge
+
+			GPIO_QueueEvent(intID, (level ? 3 : 4), db->count, values, Time_getAlarmTime() - db->period);
+			db->count = 0;
+			break;
+		}
+		default:	// LEADING: the window is closed, level mode channels are enabled again
+			break;
+	}
+}
+
+static void GPIO_InterruptHandler(uint8_t intID) {
+	uint8_t intBit = (1 << intID);
+
+	if (GPIO_debounceExpired & intBit) {
+		__disable_irq();
+		GPIO_debounceExpired &= ~intBit;
+		__enable_irq();
+
+		GPIO_DebounceExpire(intID);
+	}
+
+	if ((LPC_GPIO_PIN_INT->IST & intBit) == 0)
+		return;
+
+	time_us_t now = Time_getAlarmTime();
+	uint32_t interruptValues = GPIO_InterruptValues();
+	uint8_t interruptEvent = 0xFF;
+
+	if ((LPC_GPIO_PIN_INT->ISEL & intBit)) {	// if LEVEL mode
+		if (LPC_GPIO_PIN_INT->IENR & intBit) {	// if LEVEL interrupts are enabled
+			if (LPC_GPIO_PIN_INT->IENF & intBit) {	// HIGH mode
+				interruptEvent = 1;
+			} else {								// LOW mode
+				interruptEvent = 0;
 			}
 		}
 
-		GPIO_SEND_INT(intID, (interruptValues << 8) | interruptEvent);
+		// Level interrupt can't be cleared, so it stays disabled until the window is closed
+		NVIC_DisableIRQ(intID);
+		if (GPIO_Debounce[intID].period != 0)
+			GPIO_DebounceStart(intID, now);
+		else
+			NVIC_EnableIRQ(intID);
 
-		Time_addTimer(LPC_INTERRUPT_DOWNTIME[intID], GPIO_EnableInterruptCallback, (void*)(uint32_t)intID);
+		GPIO_QueueEvent(intID, interruptEvent, 1, interruptValues, now);
 		return;
 	}
 
-	GPIO_EnableInterrupt(intID);
+	// EDGE mode
+	if ((LPC_GPIO_PIN_INT->RISE & intBit) && (LPC_GPIO_PIN_INT->IENR & intBit)) {	// Rising edge interrupt
+		interruptEvent = 3;
+	}
+	if ((LPC_GPIO_PIN_INT->FALL & intBit) && (LPC_GPIO_PIN_INT->IENF & intBit)) {	// Falling edge interrupt
+		if (interruptEvent == 3)
+			interruptEvent = 2;				// Edge CHANGE (RISE+FALL)
+		else
+			interruptEvent = 4;				// Falling edge
+	}
+	LPC_GPIO_PIN_INT->RISE = intBit;	// Clear rising edge (sort of) flag
+	LPC_GPIO_PIN_INT->FALL = intBit;	// Clear falling edge (sort of) flag
+
+	volatile GPIO_DebounceState *db = &GPIO_Debounce[intID];
+
+	if (db->period == 0) {
+		GPIO_QueueEvent(intID, interruptEvent, 1, interruptValues, now);
+		return;
+	}
+
+	if (db->count < 0xFFFF)
+		db->count++;
+
+	switch (db->policy) {
+		case GPIO_DEBOUNCE_LEADING: {
+			if (GPIO_debounceActive & intBit) break;	// Inside the window, reported with the next event
+
+			if (GPIO_QueueEvent(intID, interruptEvent, db->count, interruptValues, now))
+				db->count = 0;
+			GPIO_DebounceStart(intID, now);
+			break;
+		}
+		case GPIO_DEBOUNCE_TRAILING: {
+			db->event = interruptEvent;
+			db->data = interruptValues;
+			db->time = now;
+			GPIO_DebounceStart(intID, now);	// Every edge restarts the window
+			break;
+		}
+		case GPIO_DEBOUNCE_STABLE: {
+			GPIO_DebounceStart(intID, now);	// Every edge restarts the window
+			break;
+		}
+	}
+}
+
+static inline void GPIO_DispatchInterrupt(uint8_t intID) {
+	GPIO_InterruptCallback handler = LPC_INTERRUPT_HANDLER[intID];
+
+	if (handler != NULL)
+		handler(intID);
+	else
+		NVIC_DisableIRQ(intID);	// Nobody owns the channel
 }
 
 void FLEX_INT0_IRQHandler() {
-	GPIO_InterruptHandler(0);
+	GPIO_DispatchInterrupt(0);
 }
 
 void FLEX_INT1_IRQHandler() {
-	GPIO_InterruptHandler(1);
+	GPIO_DispatchInterrupt(1);
 }
 
 void FLEX_INT2_IRQHandler() {
-	GPIO_InterruptHandler(2);
+	GPIO_DispatchInterrupt(2);
 }
 
 void FLEX_INT3_IRQHandler() {
-	GPIO_InterruptHandler(3);
+	GPIO_DispatchInterrupt(3);
 }
 
 void FLEX_INT4_IRQHandler() {
-	GPIO_InterruptHandler(4);
+	GPIO_DispatchInterrupt(4);
 }
 
 void FLEX_INT5_IRQHandler() {
-	GPIO_InterruptHandler(5);
+	GPIO_DispatchInterrupt(5);
 }
 
 void FLEX_INT6_IRQHandler() {
-	GPIO_InterruptHandler(6);
+	GPIO_DispatchInterrupt(6);
 }
 
 void FLEX_INT7_IRQHandler() {
-	GPIO_InterruptHandler(7);
+	GPIO_DispatchInterrupt(7);
 }
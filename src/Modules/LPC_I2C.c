@@ -33,6 +33,16 @@
 
 #include "Modules/LPC_I2C.h"
 
+#define I2C_SCL_MIN		4	// Min. SCLH/SCLL value
+#define I2C_SCL_PIN		BIT4	// PIO0_4
+#define I2C_SDA_PIN		BIT5	// PIO0_5
+#define I2C_RECOVERY_CLOCKS	9
+#define I2C_RECOVERY_HALF_PERIOD	5	// us, 100kHz
+#define I2C_BATCH_HEADER_SIZE	5	// address, writeSize, readSize, delay
+#define I2C_BATCH_RESULT_SIZE	3	// error, readCount
+
+static time_us_t I2C_timeout = I2C_TIMEOUT_DEFAULT;
+
 
 volatile struct {
 	enum {
@@ -51,13 +61,14 @@ volatile struct {
 	uint32_t writeSize;	// Number of (remaining) bytes to write
 	uint32_t readSize;	// Number of (remaining) bytes to  read
 	uint32_t readCount;	// Number of actually read bytes
+	uint32_t progress;	// Bumped on every bus event, restarts the timeout
 
 	uint8_t *writePtr;
 	uint8_t *readPtr;
 } I2CHandler;
 
 static inline void I2C_ERROR() {
-	I2CHandler.error = 1;
+	I2CHandler.error = I2C_ERR_PROTOCOL;
 	I2CHandler.status = I2C_IDLE;
 	LPC_I2C->CONSET = BIT4; // send STOP
 }
@@ -65,6 +76,8 @@ static inline void I2C_ERROR() {
 void I2C_IRQHandler(void) {
 	uint8_t status = LPC_I2C->STAT;
 
+	I2CHandler.progress++;
+
 	if (status == 0xF8) {
 		LPC_I2C->CONCLR = BIT3;
 		return;
@@ -76,7 +89,7 @@ void I2C_IRQHandler(void) {
 			if (I2CHandler.status != I2C_START) { // deny unknown i2c sources
 				I2C_ERROR();
 			} else {
-				if (I2CHandler.writeSize > 0) {
+				if (I2CHandler.writeSize > 0 || I2CHandler.readSize == 0) {	// Nothing to transfer: address probe, SLA+W and STOP
 					I2CHandler.status = I2C_SLAW;
 					LPC_I2C->DAT = I2CHandler.slaveAddress << 1; // Send SLA+W
 				} else {
@@ -88,9 +101,14 @@ void I2C_IRQHandler(void) {
 		}
 		case 0x18: {	// SLAW + ACK
 			if (I2CHandler.status == I2C_SLAW) {
-				I2CHandler.status = I2C_DATAW;
-				LPC_I2C->DAT = *I2CHandler.writePtr++;
-				I2CHandler.writeSize--;
+				if (I2CHandler.writeSize == 0) {	// Address probe
+					I2CHandler.status = I2C_IDLE;
+					LPC_I2C->CONSET = BIT4;		// send STOP
+				} else {
+					I2CHandler.status = I2C_DATAW;
+					LPC_I2C->DAT = *I2CHandler.writePtr++;
+					I2CHandler.writeSize--;
+				}
 			} else {
 				I2C_ERROR();
 			}
@@ -98,7 +116,7 @@ void I2C_IRQHandler(void) {
 		}
 		case 0x20: {	// SLAW + NACK
 			if (I2CHandler.status == I2C_SLAW) {
-				I2CHandler.error = 0x20;
+				I2CHandler.error = I2C_ERR_ADDRESS_NACK;
 				I2CHandler.status = I2C_IDLE;
 				LPC_I2C->CONSET = BIT4;//set stop
 			} else {
@@ -127,7 +145,7 @@ void I2C_IRQHandler(void) {
 		}
 		case 0x30: {	// DATAW + NACK
 			if (I2CHandler.status == I2C_DATAW) {
-				I2CHandler.error = 0x30;
+				I2CHandler.error = I2C_ERR_DATA_NACK;
 				I2CHandler.status = I2C_IDLE;
 				LPC_I2C->CONSET = BIT4;	// send STOP
 			} else {
@@ -160,7 +178,7 @@ void I2C_IRQHandler(void) {
 		}
 		case 0x48: {	// SLAR + NACK
 			if (I2CHandler.status == I2C_SLAR) {
-				I2CHandler.error = 0x48;
+				I2CHandler.error = I2C_ERR_READ_ADDRESS_NACK;
 				I2CHandler.status = I2C_IDLE;
 				//LPC_I2C->CONCLR = BIT5;
 				LPC_I2C->CONSET = BIT4;	// send STOP
@@ -170,7 +188,7 @@ void I2C_IRQHandler(void) {
 			break;
 		}
 		case 0x50: {	// DATAR + ACK
-			if (I2CHandler.status == I2C_DATAR) {
+			if (I2CHandler.status == I2C_DATAR && I2CHandler.readSize > 0) {	// Never write past the read buffer
 				*I2CHandler.readPtr++ = LPC_I2C->DAT;
 				I2CHandler.readCount++;
 				I2CHandler.readSize--;
@@ -184,7 +202,7 @@ void I2C_IRQHandler(void) {
 			break;
 		}
 		case 0x58: {	// DATAR + NACK
-			if (I2CHandler.status == I2C_DATAR) {
+			if (I2CHandler.status == I2C_DATAR && I2CHandler.readSize > 0) {	// Never write past the read buffer
 				*I2CHandler.readPtr++ = LPC_I2C->DAT;
 				I2CHandler.readCount++;
 				I2CHandler.readSize--;
@@ -193,7 +211,7 @@ void I2C_IRQHandler(void) {
 				LPC_I2C->CONSET = BIT4;	// send STOP
 
 				if (I2CHandler.readSize != 0) {	// if it's not the last byte
-					I2CHandler.error = 0x58;
+					I2CHandler.error = I2C_ERR_READ_NACK;
 				}
 			} else {
 				I2C_ERROR();
@@ -201,7 +219,7 @@ void I2C_IRQHandler(void) {
 			break;
 		}
 		case 0x38: {	// Arbitration lost
-			I2CHandler.error = 0x38;
+			I2CHandler.error = I2C_ERR_ARBITRATION;
 			I2CHandler.status = I2C_IDLE;
 			LPC_I2C->CONSET = BIT4;//set stop
 			break;
@@ -217,23 +235,205 @@ void I2C_IRQHandler(void) {
 
 }
 
+/*
+ * Splits the SCL period into SCLH/SCLL. Standard mode runs at 50% duty, Fast
+ * and Fast-mode Plus need a longer low phase (tLOW/tHIGH min. 1.3/0.6us and
+ * 0.5/0.26us), so the low phase gets 2/3 of the period there.
+ */
+static uint32_t I2C_SetRate(uint32_t target) {
+	uint32_t period = (SystemCoreClock + target - 1) / target;	// PCLK cycles, rounded up so SCL is not above target
+	uint32_t low;
+
+	if (period < 2*I2C_SCL_MIN) period = 2*I2C_SCL_MIN;
+	if (period > 2*0xFFFF) period = 2*0xFFFF;
+
+	if (target <= I2C_RATE_STANDARD)
+		low = (period + 1) / 2;
+	else
+		low = (period*2 + 2) / 3;
+
+	LPC_I2C->SCLL = low;
+	LPC_I2C->SCLH = period - low;
+
+	// I2CMODE: Fast-mode Plus pads for rates above Fast mode, standard I2C otherwise
+	uint32_t i2cMode = (target > I2C_RATE_FAST ? 0x2 : 0x0) << 8;
+	LPC_IOCON->PIO0_4 = (LPC_IOCON->PIO0_4 & ~(0x3 << 8)) | i2cMode;	// SCL
+	LPC_IOCON->PIO0_5 = (LPC_IOCON->PIO0_5 & ~(0x3 << 8)) | i2cMode;	// SDA
+
+	return SystemCoreClock / period;
+}
+
+/*
+ * i2c_begin([rate[, timeout]]): rate in Hz up to 1MHz, 100kHz by default. The
+ * achieved rate is sent back when one is given. timeout is the max. time in us
+ * a transaction may go without bus activity (0 - no limit), after it the
+ * transaction is aborted and the bus is recovered if it is held.
+ */
 SFPResult lpc_i2c_begin(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 0)
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount > 2)
 			return SFP_ERR_ARG_COUNT;
 
+	uint32_t i;
+	for (i=0; i<argCount; i++) {
+		if (SFPFunction_getArgumentType(msg, i) != SFP_ARG_INT)
+			return SFP_ERR_ARG_TYPE;
+	}
+
+	uint32_t p_rate = (argCount > 0 ? SFPFunction_getArgument_int32(msg, 0) : I2C_RATE_STANDARD);
+	uint32_t p_timeout = (argCount > 1 ? SFPFunction_getArgument_int32(msg, 1) : I2C_TIMEOUT_DEFAULT);
+	if (p_rate == 0 || p_rate > I2C_RATE_FAST_PLUS || p_timeout > 0x7FFFFFFF)
+		return SFP_ERR_ARG_VALUE;
+
+	I2C_timeout = p_timeout;
+
 	LPC_SYSCON->PRESETCTRL |= BIT1; 	// de-assert I2C
 	LPC_SYSCON->SYSAHBCLKCTRL |= BIT5;	// enable I2C clock
 
 	LPC_I2C->CONCLR = BIT6 | BIT5 | BIT3 | BIT2;	// Clear all
-	LPC_I2C->SCLH = 240; // Set I2C speed 48MHz/(240+240) = 100kHz
-	LPC_I2C->SCLL = 240;
+	uint32_t rate = I2C_SetRate(p_rate);	// 48MHz/(240+240) = 100kHz by default
 
 	NVIC_EnableIRQ(I2C_IRQn);
 	LPC_I2C->CONSET = BIT6; //Enable I2C Master mode
 
+	if (argCount > 0) {
+		SFPFunction *outFunc = SFPFunction_new();
+
+		if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+
+		SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+		SFPFunction_setID(outFunc, UPER_FID_I2CBEGIN);
+		SFPFunction_setName(outFunc, UPER_FNAME_I2CBEGIN);
+		SFPFunction_addArgument_int32(outFunc, rate);
+		SFPFunction_send(outFunc, &stream);
+		SFPFunction_delete(outFunc);
+	}
+
 	return SFP_OK;
 }
 
+static inline void I2C_Wait(time_us_t time) {
+	time_us_t end = Time_getAlarmTime() + time;
+	while ((int32_t)(Time_getAlarmTime() - end) < 0);
+}
+
+static inline uint8_t I2C_BusHeld(void) {
+	return ((LPC_GPIO->PIN[0] & (I2C_SCL_PIN | I2C_SDA_PIN)) != (I2C_SCL_PIN | I2C_SDA_PIN));
+}
+
+/*
+ * Aborts the transaction in progress by resetting the I2C block. Nothing is
+ * driven on the bus.
+ */
+static void I2C_Reset(void) {
+	uint32_t sclh = LPC_I2C->SCLH, scll = LPC_I2C->SCLL;
+
+	NVIC_DisableIRQ(I2C_IRQn);
+
+	LPC_SYSCON->PRESETCTRL &= ~BIT1;	// reset I2C
+	LPC_SYSCON->PRESETCTRL |= BIT1;
+	LPC_I2C->CONCLR = BIT6 | BIT5 | BIT3 | BIT2;	// Clear all
+	LPC_I2C->SCLH = sclh;
+	LPC_I2C->SCLL = scll;
+
+	I2CHandler.status = I2C_IDLE;
+	NVIC_EnableIRQ(I2C_IRQn);
+	LPC_I2C->CONSET = BIT6; //Enable I2C Master mode
+}
+
+/*
+ * Frees a bus held by a slave: SCL is clocked as GPIO until the slave lets SDA
+ * go (at most I2C_RECOVERY_CLOCKS), then a STOP is generated and the I2C block
+ * is reset. Returns 0 if the bus is free afterwards.
+ */
+static uint8_t I2C_Recover(void) {
+	uint32_t sclConfig = LPC_IOCON->PIO0_4, sdaConfig = LPC_IOCON->PIO0_5;
+	uint32_t i;
+
+	NVIC_DisableIRQ(I2C_IRQn);
+	LPC_I2C->CONCLR = BIT6 | BIT5 | BIT3 | BIT2;	// I2C disabled
+
+	// Open drain pins: output low when DIR is set, released otherwise
+	LPC_GPIO->CLR[0] = I2C_SCL_PIN | I2C_SDA_PIN;
+	LPC_GPIO->DIR[0] &= ~(I2C_SCL_PIN | I2C_SDA_PIN);
+	LPC_IOCON->PIO0_4 = sclConfig & ~0x7;	// GPIO function
+	LPC_IOCON->PIO0_5 = sdaConfig & ~0x7;
+
+	for (i=0; i<I2C_RECOVERY_CLOCKS && !(LPC_GPIO->PIN[0] & I2C_SDA_PIN); i++) {
+		LPC_GPIO->DIR[0] |= I2C_SCL_PIN;	// SCL low
+		I2C_Wait(I2C_RECOVERY_HALF_PERIOD);
+		LPC_GPIO->DIR[0] &= ~I2C_SCL_PIN;	// SCL released
+		I2C_Wait(I2C_RECOVERY_HALF_PERIOD);
+	}
+
+	// STOP: SDA rises while SCL is high
+	LPC_GPIO->DIR[0] |= I2C_SCL_PIN;
+	I2C_Wait(I2C_RECOVERY_HALF_PERIOD);
+	LPC_GPIO->DIR[0] |= I2C_SDA_PIN;
+	I2C_Wait(I2C_RECOVERY_HALF_PERIOD);
+	LPC_GPIO->DIR[0] &= ~I2C_SCL_PIN;
+	I2C_Wait(I2C_RECOVERY_HALF_PERIOD);
+	LPC_GPIO->DIR[0] &= ~I2C_SDA_PIN;
+	I2C_Wait(I2C_RECOVERY_HALF_PERIOD);
+
+	uint8_t stuck = I2C_BusHeld();
+
+	LPC_IOCON->PIO0_4 = sclConfig;
+	LPC_IOCON->PIO0_5 = sdaConfig;
+
+	I2C_Reset();
+
+	return stuck;
+}
+
+uint32_t I2C_Transfer(uint8_t address, uint8_t *write, uint32_t writeSize, uint8_t *read, uint32_t readSize, uint32_t *readCount) {
+	*readCount = 0;
+	if ((LPC_SYSCON->SYSAHBCLKCTRL & BIT5) == 0)	// Not started
+		return I2C_ERR_PROTOCOL;
+
+	if (!(LPC_GPIO->PIN[0] & I2C_SDA_PIN) && I2C_Recover())	// SDA held low by a slave
+		return I2C_ERR_BUS_STUCK;
+
+	/* Initialize I2C Transfer parameters */
+	I2CHandler.error = 0;
+	I2CHandler.slaveAddress = address & 0x7F;
+	I2CHandler.writePtr = write;
+	I2CHandler.writeSize = writeSize;
+	I2CHandler.readPtr = read;
+	I2CHandler.readSize = readSize;
+	I2CHandler.readCount = 0;
+
+	/* Start I2C Transfer */
+	I2CHandler.status = I2C_START;
+	LPC_I2C->CONCLR = BIT4; //clear stop
+	LPC_I2C->CONSET = BIT5; // Initiate START
+
+	time_us_t start = Time_getAlarmTime();
+	uint32_t progress = I2CHandler.progress;
+	while (I2CHandler.status != I2C_IDLE) { // Wait for transfer to complete
+		if (I2CHandler.progress != progress) {	// Still moving, the timeout only catches stalls
+			progress = I2CHandler.progress;
+			start = Time_getAlarmTime();
+		} else if (I2C_timeout != 0 && (Time_getAlarmTime() - start) >= I2C_timeout) {
+			*readCount = I2CHandler.readCount;
+			if (I2C_BusHeld())	// A slave keeps SCL or SDA low
+				return (I2C_Recover() ? I2C_ERR_BUS_STUCK : I2C_ERR_TIMEOUT);
+			I2C_Reset();
+			return I2C_ERR_TIMEOUT;
+		}
+	}
+
+	*readCount = I2CHandler.readCount;
+
+	// Arbitration loss leaves the bus to the other master, it is never recovered
+	if (I2CHandler.error == I2C_ERR_PROTOCOL && I2C_BusHeld()) {
+		if (I2C_Recover())	// A glitch left a slave holding the bus
+			return I2C_ERR_BUS_STUCK;
+	}
+
+	return I2CHandler.error;
+}
+
 SFPResult lpc_i2c_trans(SFPFunction *msg) {
 	if (SFPFunction_getArgumentCount(msg) != 3)
 		return SFP_ERR_ARG_COUNT;
@@ -243,30 +443,22 @@ SFPResult lpc_i2c_trans(SFPFunction *msg) {
 			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT)
 		return SFP_ERR_ARG_TYPE;
 
+	uint8_t address = SFPFunction_getArgument_int32(msg, 0) & 0x7F;
+	uint32_t writeSize;
+	uint8_t *writeData = SFPFunction_getArgument_barray(msg, 1, &writeSize);
+	uint32_t readSize = SFPFunction_getArgument_int32(msg, 2);
+	uint32_t readCount = 0;
 
-	/* Initialize I2C Transfer parameters */
-	I2CHandler.error = 0;
-	I2CHandler.slaveAddress = SFPFunction_getArgument_int32(msg, 0) & 0x7F;
-	I2CHandler.writePtr = SFPFunction_getArgument_barray(msg, 1, (uint32_t*)&I2CHandler.writeSize);
-	I2CHandler.readSize = SFPFunction_getArgument_int32(msg, 2);
-	I2CHandler.readCount = 0;
-
-	//if (I2CHandler.writeSize == 0 && I2CHandler.readSize == 0) return SFP_ERR_ARG_VALUE;
+	//if (writeSize == 0 && readSize == 0) return SFP_ERR_ARG_VALUE;
 
 	uint8_t *bundleBuf = NULL;
-	//if (I2CHandler.readSize != 0) {
-		bundleBuf = (uint8_t*)MemoryManager_malloc(I2CHandler.readSize);
+	//if (readSize != 0) {
+		bundleBuf = (uint8_t*)MemoryManager_malloc(readSize);
 		if (bundleBuf == NULL)
 			return SFP_ERR_ALLOC_FAILED;
 	//}
-	I2CHandler.readPtr = bundleBuf;
 
-	/* Start I2C Transfer */
-	I2CHandler.status = I2C_START;
-	LPC_I2C->CONCLR = BIT4; //clear stop
-	LPC_I2C->CONSET = BIT5; // Initiate START
-
-	while (I2CHandler.status != I2C_IDLE); // Wait for transfer to complete
+	uint32_t error = I2C_Transfer(address, writeData, writeSize, bundleBuf, readSize, &readCount);
 
 	SFPFunction *outFunc = SFPFunction_new();
 
@@ -279,9 +471,9 @@ SFPResult lpc_i2c_trans(SFPFunction *msg) {
 	SFPFunction_setID(outFunc, UPER_FID_I2CTRANS);
 	SFPFunction_setName(outFunc, UPER_FNAME_I2CTRANS);
 
-	SFPFunction_addArgument_int32(outFunc, I2CHandler.slaveAddress);
-	SFPFunction_addArgument_barray(outFunc, bundleBuf, I2CHandler.readCount);
-	SFPFunction_addArgument_int32(outFunc, I2CHandler.error);
+	SFPFunction_addArgument_int32(outFunc, address);
+	SFPFunction_addArgument_barray(outFunc, bundleBuf, readCount);
+	SFPFunction_addArgument_int32(outFunc, error);
 
 	SFPFunction_send(outFunc, &stream);
 	SFPFunction_delete(outFunc);
@@ -291,6 +483,87 @@ SFPResult lpc_i2c_trans(SFPFunction *msg) {
 	return SFP_OK;
 }
 
+/*
+ * i2c_batch(transactions[, stopOnError]): transactions are packed back to back as
+ *   address, writeSize, readSize, delay (16-bit LE, us before the transaction), write data
+ * The reply i2c_batch(results) holds for each transaction that ran:
+ *   error (16-bit LE, I2C_ERR_x), readCount, read data
+ */
+SFPResult lpc_i2c_batch(SFPFunction *msg) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 1 && argCount != 2)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_BYTE_ARRAY
+			|| (argCount == 2 && SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT))
+		return SFP_ERR_ARG_TYPE;
+
+	uint32_t batchSize;
+	uint8_t *batch = SFPFunction_getArgument_barray(msg, 0, &batchSize);
+	uint8_t stopOnError = (argCount == 2 ? SFPFunction_getArgument_int32(msg, 1) & 0x1 : 0);
+
+	if (batchSize == 0) return SFP_ERR_ARG_VALUE;
+
+	// Check the batch and size the reply before touching the bus
+	uint32_t pos = 0, resultSize = 0;
+	while (pos < batchSize) {
+		if (pos + I2C_BATCH_HEADER_SIZE > batchSize) return SFP_ERR_ARG_VALUE;
+
+		uint32_t writeSize = batch[pos+1];
+		uint32_t readSize = batch[pos+2];
+		pos += I2C_BATCH_HEADER_SIZE + writeSize;
+		if (pos > batchSize) return SFP_ERR_ARG_VALUE;
+
+		resultSize += I2C_BATCH_RESULT_SIZE + readSize;
+	}
+
+	uint8_t *results = MemoryManager_malloc(resultSize);
+	if (results == NULL)
+		return SFP_ERR_ALLOC_FAILED;
+
+	uint8_t *res = results;
+	pos = 0;
+	while (pos < batchSize) {
+		uint8_t address = batch[pos] & 0x7F;
+		uint32_t writeSize = batch[pos+1];
+		uint32_t readSize = batch[pos+2];
+		uint32_t delay = batch[pos+3] | (batch[pos+4] << 8);
+		uint8_t *writeData = &batch[pos+I2C_BATCH_HEADER_SIZE];
+		uint32_t readCount;
+		pos += I2C_BATCH_HEADER_SIZE + writeSize;
+
+		if (delay != 0)
+			I2C_Wait(delay);
+
+		uint32_t error = I2C_Transfer(address, writeData, writeSize, &res[I2C_BATCH_RESULT_SIZE], readSize, &readCount);
+		if (readCount > readSize) readCount = readSize;	// Never step past the space of this entry
+		res[0] = error;
+		res[1] = error >> 8;
+		res[2] = readCount;
+		res += I2C_BATCH_RESULT_SIZE + readCount;
+
+		if (error != I2C_ERR_NONE && stopOnError) break;
+	}
+
+	SFPFunction *outFunc = SFPFunction_new();
+
+	if (outFunc == NULL) {
+		MemoryManager_free(results);
+		return SFP_ERR_ALLOC_FAILED;
+	}
+
+	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+	SFPFunction_setID(outFunc, UPER_FID_I2CBATCH);
+	SFPFunction_setName(outFunc, UPER_FNAME_I2CBATCH);
+	SFPFunction_addArgument_barray(outFunc, results, res - results);
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	MemoryManager_free(results);
+
+	return SFP_OK;
+}
+
 SFPResult lpc_i2c_end(SFPFunction *msg) {
 	if (SFPFunction_getArgumentCount(msg) != 0)
 		return SFP_ERR_ARG_COUNT;
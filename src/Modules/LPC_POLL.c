@@ -0,0 +1,230 @@
+/**
+ * @file	LPC_POLL.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+
+#include "Modules/LPC_POLL.h"
+#include "Modules/LPC_SPI.h"
+#include "Modules/LPC_I2C.h"
+#include "Modules/LPC_GPIO.h"
+
+#include <string.h>
+
+#define POLL_ERR_BUS		0xFF	// SPI port not started or busy
+
+typedef struct {
+	uint8_t active;
+	uint8_t bus;
+	uint8_t address;		// I2C slave address or SPI CS pin
+	uint8_t csActiveHigh;
+	uint8_t reported;		// A result was sent already
+	SFPFunctionType type;
+
+	uint8_t *write;			// Single allocation: write data, mask, last and current result
+	uint8_t *mask;
+	uint8_t *last;
+	uint8_t *read;
+	uint32_t writeSize;
+	uint32_t readSize;
+	uint32_t lastError;
+
+	time_us_t period;
+	time_us_t next;			// Time_getAlarmTime() of the next run
+	uint32_t every;			// Report every N-th run, 0 - changes only
+	uint32_t runs;			// Runs since the last report
+} Poll_t;
+
+static Poll_t polls[POLL_COUNT];
+
+static void POLL_Free(Poll_t *poll) {
+	poll->active = 0;
+	if (poll->write != NULL)
+		MemoryManager_free(poll->write);
+	poll->write = NULL;
+}
+
+static void POLL_Run(uint8_t id) {
+	Poll_t *poll = &polls[id];
+	uint32_t error, readCount = poll->readSize, i;
+	time_us_t time = Time_getAlarmTime();
+
+	if (poll->bus == POLL_BUS_I2C) {
+		error = I2C_Transfer(poll->address, poll->write, poll->writeSize, poll->read, poll->readSize, &readCount);
+	} else {
+		error = (SPI_Transfer(poll->bus - POLL_BUS_SPI0, poll->address, poll->csActiveHigh,
+				poll->write, poll->writeSize, poll->read, poll->readSize) ? POLL_ERR_BUS : 0);
+		if (error)
+			readCount = 0;	// Nothing was read, the old data is not reported as new
+	}
+
+	for (i=readCount; i<poll->readSize; i++)	// Bytes not read compare as zeroes
+		poll->read[i] = 0;
+
+	uint8_t changed = (!poll->reported || error != poll->lastError);
+	for (i=0; i<poll->readSize; i++) {
+		if ((poll->read[i] ^ poll->last[i]) & poll->mask[i])
+			changed = 1;
+	}
+
+	poll->runs++;
+	if (!changed && (poll->every == 0 || poll->runs < poll->every))
+		return;
+
+	SFPFunction *outFunc = SFPFunction_new();
+	if (outFunc == NULL) return;	// Reported on the next run
+
+	SFPFunction_setType(outFunc, poll->type);
+	SFPFunction_setID(outFunc, UPER_FID_POLL);
+	SFPFunction_setName(outFunc, UPER_FNAME_POLL);
+	SFPFunction_addArgument_int32(outFunc, id);
+	SFPFunction_addArgument_barray(outFunc, poll->read, readCount);
+	SFPFunction_addArgument_int32(outFunc, time);
+	SFPFunction_addArgument_int32(outFunc, error);
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	memcpy(poll->last, poll->read, poll->readSize);
+	poll->lastError = error;
+	poll->reported = 1;
+	poll->runs = 0;
+}
+
+void POLL_Process(void) {
+	uint8_t id;
+	for (id=0; id<POLL_COUNT; id++) {
+		Poll_t *poll = &polls[id];
+		if (!poll->active) continue;
+
+		time_us_t now = Time_getAlarmTime();
+		if ((int32_t)(now - poll->next) < 0) continue;
+
+		poll->next += poll->period;		// Runs stay on the period grid
+		if ((int32_t)(now - poll->next) >= 0)	// Fell behind, skip the missed runs
+			poll->next = now + poll->period;
+
+		POLL_Run(id);
+	}
+}
+
+/*
+ * poll_begin(id, bus, address, write, readSize, period[, mask[, every]])
+ * bus: POLL_BUS_x; address: I2C slave address, or SPI CS pin (SPI_CS_NONE - none)
+ * with BIT8 set for an active-high CS; period in us (up to 0x7FFFFFFF); mask:
+ * readSize bytes, the bits compared for changes (default all); every: also
+ * report every N-th run.
+ * Results are sent as poll(id, data, time, error) when they change.
+ */
+SFPResult lpc_poll_begin(SFPFunction *msg) {
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount < 6 || argCount > 8)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 3) != SFP_ARG_BYTE_ARRAY
+			|| SFPFunction_getArgumentType(msg, 4) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 5) != SFP_ARG_INT
+			|| (argCount > 6 && SFPFunction_getArgumentType(msg, 6) != SFP_ARG_BYTE_ARRAY)
+			|| (argCount > 7 && SFPFunction_getArgumentType(msg, 7) != SFP_ARG_INT))
+		return SFP_ERR_ARG_TYPE;
+
+	uint32_t p_id = SFPFunction_getArgument_int32(msg, 0);
+	uint32_t p_bus = SFPFunction_getArgument_int32(msg, 1);
+	uint32_t p_address = SFPFunction_getArgument_int32(msg, 2);
+	uint32_t writeSize;
+	uint8_t *p_write = SFPFunction_getArgument_barray(msg, 3, &writeSize);
+	uint32_t p_readSize = SFPFunction_getArgument_int32(msg, 4);
+	uint32_t p_period = SFPFunction_getArgument_int32(msg, 5);
+	uint32_t maskSize = p_readSize;
+	uint8_t *p_mask = (argCount > 6 ? SFPFunction_getArgument_barray(msg, 6, &maskSize) : NULL);
+	uint32_t p_every = (argCount > 7 ? SFPFunction_getArgument_int32(msg, 7) : 0);
+
+	if (p_id >= POLL_COUNT || p_bus > POLL_BUS_SPI1 || p_readSize > POLL_READ_MAX
+			|| (writeSize == 0 && p_readSize == 0) || maskSize != p_readSize
+			|| p_period < POLL_PERIOD_MIN || p_period > 0x7FFFFFFF)	// Times are compared as int32_t
+		return SFP_ERR_ARG_VALUE;
+
+	if (p_bus == POLL_BUS_I2C ? p_address > 0x7F : (p_address & 0xFF) != SPI_CS_NONE && (p_address & 0xFF) >= LPC_PIN_COUNT)
+		return SFP_ERR_ARG_VALUE;
+
+	Poll_t *poll = &polls[p_id];
+	POLL_Free(poll);
+
+	uint8_t *buffer = MemoryManager_malloc(writeSize + 3*p_readSize);
+	if (buffer == NULL)
+		return SFP_ERR_ALLOC_FAILED;
+
+	poll->write = buffer;
+	poll->mask = buffer + writeSize;
+	poll->last = poll->mask + p_readSize;
+	poll->read = poll->last + p_readSize;
+	memcpy(poll->write, p_write, writeSize);
+	if (p_mask != NULL)
+		memcpy(poll->mask, p_mask, p_readSize);
+	else
+		memset(poll->mask, 0xFF, p_readSize);
+
+	poll->bus = p_bus;
+	poll->address = p_address & 0xFF;
+	poll->csActiveHigh = (p_address & BIT8) ? 1 : 0;
+	poll->writeSize = writeSize;
+	poll->readSize = p_readSize;
+	poll->period = p_period;
+	poll->every = p_every;
+	poll->runs = 0;
+	poll->reported = 0;
+	poll->type = SFPFunction_getType(msg);
+	poll->next = Time_getAlarmTime();	// First run right away
+	poll->active = 1;
+
+	return SFP_OK;
+}
+
+/*
+ * poll_end(id)
+ */
+SFPResult lpc_poll_end(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint32_t p_id = SFPFunction_getArgument_int32(msg, 0);
+	if (p_id >= POLL_COUNT)
+		return SFP_ERR_ARG_VALUE;
+
+	POLL_Free(&polls[p_id]);
+
+	return SFP_OK;
+}
@@ -32,209 +32,993 @@
 
 
 #include "Modules/LPC_SPI.h"
+#include "Modules/LPC_GPIO.h"
+
+#include <string.h>
+
+#define SPI_LEGACY_DIVIDER_MAX	256		// Smaller begin rates are SCR dividers of 2MHz (old API)
+#define SPI_RATE_MAX			24000000	// Master mode max: SSP clock/2
+#define SPI_FIFO_DEPTH			8
+#define SPI_CHUNK_SIZE			128		// Max read data in a single reply, even
 
 /*
- * SPI0
+ * SSP block descriptors, both ports share the driver below
  */
-SFPResult lpc_spi0_begin(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 2)
+typedef struct {
+	LPC_SSPx_Type *ssp;
+	volatile uint32_t *clkdiv;	// SSPxCLKDIV
+	uint32_t resetBit;			// PRESETCTRL
+	uint32_t clockBit;			// SYSAHBCLKCTRL
+	IRQn_Type irq;
+	uint8_t sselPin;			// SSEL pin ID (slave mode)
+	uint8_t sselFunction;		// IOCON FUNC of SSEL
+	uint8_t fidBegin;
+	uint8_t fidTrans;
+	uint8_t fidDone;
+	uint8_t fidXfer;
+	uint8_t fidSlave;
+	const char *fnameBegin;
+	const char *fnameTrans;
+	const char *fnameDone;
+	const char *fnameXfer;
+	const char *fnameSlave;
+} SPI_Port;
+
+static const SPI_Port SPI_PORTS[SPI_PORT_COUNT] = {
+		{ LPC_SSP0, &LPC_SYSCON->SSP0CLKDIV, BIT0, BIT11, SSP0_IRQn, 1, 0x1,	// SSEL0: PIO0_2
+				UPER_FID_SPI0BEGIN, UPER_FID_SPI0TRANS, UPER_FID_SPI0DONE, UPER_FID_SPI0XFER, UPER_FID_SPI0SLAVE,
+				UPER_FNAME_SPI0BEGIN, UPER_FNAME_SPI0TRANS, UPER_FNAME_SPI0DONE, UPER_FNAME_SPI0XFER, UPER_FNAME_SPI0SLAVE },
+		{ LPC_SSP1, &LPC_SYSCON->SSP1CLKDIV, BIT2, BIT18, SSP1_IRQn, 6, 0x2,	// SSEL1: PIO1_23
+				UPER_FID_SPI1BEGIN, UPER_FID_SPI1TRANS, UPER_FID_SPI1DONE, UPER_FID_SPI1XFER, UPER_FID_SPI1SLAVE,
+				UPER_FNAME_SPI1BEGIN, UPER_FNAME_SPI1TRANS, UPER_FNAME_SPI1DONE, UPER_FNAME_SPI1XFER, UPER_FNAME_SPI1SLAVE },
+};
+
+/*
+ * Background transfers. The SSP ISR moves the frames, the buffer holds the
+ * write data and is overwritten with the read data in place.
+ */
+static volatile struct {
+	enum {
+		SPI_ASYNC_IDLE=0,
+		SPI_ASYNC_BUSY,
+		SPI_ASYNC_DONE,
+		SPI_ASYNC_SLAVE,	// Slave mode, see SPI_Slave
+	} status;
+
+	uint8_t *buffer;
+	uint8_t wide;
+	uint8_t read;			// Read data is sent back
+	uint32_t tag;
+	uint32_t frames;
+	uint32_t written;
+	uint32_t received;
+	uint32_t sent;			// Bytes of read data reported, SPI_SendDone resumes from here
+	SFPFunctionType type;
+} SPIAsync[SPI_PORT_COUNT];
+
+/*
+ * Slave mode. The response frames are sent in a loop, an empty response leaves
+ * MISO undriven. SSEL is routed to the SSP and a pin interrupt on its rising
+ * edge restarts the response, so every transaction gets it from the first
+ * frame. Received frames are collected into bursts: a burst ends with the
+ * transaction, after gap us without frames or when it fills a reply.
+ */
+#define SPI_SLAVE_RING_SIZE		256		// Captured data bytes, power of 2
+#define SPI_SLAVE_BURST_COUNT	16		// power of 2
+#define SPI_SLAVE_GAP_DEFAULT	1000	// us
+#define SPI_SLAVE_NONE			0xFF
+
+typedef struct {
+	time_us_t time;		// First frame
+	time_us_t last;		// Last frame
+	uint16_t size;		// Bytes
+} SPI_SlaveBurst;
+
+static volatile struct {
+	uint8_t port;		// SPI_SLAVE_NONE - slave mode is off
+	int8_t intID;		// Pin interrupt channel of SSEL
+	uint32_t sselConfig;	// IOCON of SSEL before slave mode
+	uint32_t cr0;
+	uint8_t closed;		// SSEL went high, the next frame starts a new burst
+	time_us_t gap;
+
+	uint8_t data[SPI_SLAVE_RING_SIZE];
+	uint16_t head, tail;
+
+	SPI_SlaveBurst bursts[SPI_SLAVE_BURST_COUNT];
+	uint8_t burstHead, burstTail;
+
+	uint32_t dropped;	// Frames lost since the last report, an Rx FIFO overrun counts as one
+} SPISlave = { .port = SPI_SLAVE_NONE };
+
+static uint8_t SPI_frameBits[SPI_PORT_COUNT];	// 4-16
+
+#define SPI_FRAME_BYTES(port)	(SPI_frameBits[port] > 8 ? 2 : 1)	// Frames over 8 bits are 16-bit little endian
+
+/*
+ * Finds the closest bit rate not above the target. The rate is
+ * sspClock/(CPSR*(SCR+1)), CPSR is even 2-254, SCR is 0-255.
+ */
+static uint32_t SPI_SetRate(LPC_SSPx_Type *ssp, uint32_t sspClock, uint32_t target, uint32_t *scrOut) {
+	uint32_t cpsr, bestRate = 0, bestCpsr = 254, bestScr = 255;
+
+	for (cpsr=2; cpsr<=254; cpsr+=2) {
+		uint32_t div = (sspClock / cpsr + target - 1) / target;	// SCR+1, rounded up
+		if (div == 0) div = 1;
+
+		uint32_t rate = sspClock / (cpsr*div);
+		if (rate > target) rate = sspClock / (cpsr*(++div));
+		if (div > 256) continue;
+
+		if (rate > bestRate) {
+			bestRate = rate;
+			bestCpsr = cpsr;
+			bestScr = div - 1;
+		}
+		if (rate == target) break;
+	}
+
+	if (bestRate == 0)	// Target is below the slowest rate
+		bestRate = sspClock / (bestCpsr*(bestScr+1));
+
+	ssp->CPSR = bestCpsr;
+	*scrOut = bestScr;
+
+	return bestRate;
+}
+
+/*
+ * spiX_begin(rate, mode[, sspClockDivider[, frameBits]]): rate in Hz, or the SCR
+ * divider of 2MHz when it is not above SPI_LEGACY_DIVIDER_MAX. The achieved
+ * rate is sent back for the Hz form only.
+ */
+static SFPResult SPI_Begin(uint8_t port, SFPFunction *msg) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+	LPC_SSPx_Type *ssp = spi->ssp;
+
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount < 2 || argCount > 4)
 		return SFP_ERR_ARG_COUNT;
 
-	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
-			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT)
-		return SFP_ERR_ARG_TYPE;
+	uint32_t i;
+	for (i=0; i<argCount; i++) {
+		if (SFPFunction_getArgumentType(msg, i) != SFP_ARG_INT)
+			return SFP_ERR_ARG_TYPE;
+	}
 
-	uint32_t divider = (SFPFunction_getArgument_int32(msg, 0)-1) & 0xFF;
+	uint32_t p_rate = SFPFunction_getArgument_int32(msg, 0);
 	uint32_t mode = SFPFunction_getArgument_int32(msg, 1) & 0x3;
+	uint32_t p_clkdiv = (argCount > 2 ? SFPFunction_getArgument_int32(msg, 2) : 1);
+	uint32_t p_frameBits = (argCount > 3 ? SFPFunction_getArgument_int32(msg, 3) : 8);
 
-	LPC_SYSCON->PRESETCTRL |= 1; 		// de-assert SPI0
-	LPC_SYSCON->SYSAHBCLKCTRL |= BIT11;	// enable SPI0 clock
-	LPC_SYSCON->SSP0CLKDIV = 1; //48MHz
+	if (p_rate == 0 || p_clkdiv == 0 || p_clkdiv > 255 || p_frameBits < 4 || p_frameBits > 16)
+		return SFP_ERR_ARG_VALUE;
 
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE) return SFP_ERR_ARG_VALUE;	// Port is busy
 
-	LPC_SSP0->CR1 = 0;		// Master mode, SPI disabled
-	LPC_SSP0->CPSR = 24;	// 48MHz/24 = 2MHz
-	LPC_SSP0->CR0 = (0x7) | (0 << 4) | (mode << 6) | (divider << 8); // 8bits, SPI mode x
-	LPC_SSP0->IMSC = 0;		// Interrupts disabled
-	LPC_SSP0->CR1 = BIT1;	//Master mode, SPI enabled
+	LPC_SYSCON->PRESETCTRL |= spi->resetBit; 		// de-assert SPIx
+	LPC_SYSCON->SYSAHBCLKCTRL |= spi->clockBit;	// enable SPIx clock
+	*spi->clkdiv = p_clkdiv; // 48MHz/clkdiv
 
-	while (LPC_SSP0->SR & BIT4);	// wait while BUSY (reading or writing)
+	uint32_t sspClock = SystemCoreClock / p_clkdiv;
+	uint32_t scr, rate = 0;
 
-	while (LPC_SSP0->SR & BIT2) {	// Read while Rx FIFO not empty
-		LPC_SSP0->DR;
+	ssp->CR1 = 0;		// Master mode, SPI disabled
+	if (p_rate <= SPI_LEGACY_DIVIDER_MAX) {
+		ssp->CPSR = 24;	// 48MHz/24 = 2MHz
+		scr = p_rate - 1;
+	} else {
+		if (p_rate > SPI_RATE_MAX) p_rate = SPI_RATE_MAX;
+		rate = SPI_SetRate(ssp, sspClock, p_rate, &scr);
+	}
+	ssp->CR0 = (p_frameBits - 1) | (0 << 4) | (mode << 6) | (scr << 8); // x bits, SPI mode x
+	ssp->IMSC = 0;		// Interrupts disabled
+	ssp->CR1 = BIT1;	//Master mode, SPI enabled
+
+	SPI_frameBits[port] = p_frameBits;
+
+	while (ssp->SR & BIT4);	// wait while BUSY (reading or writing)
+
+	while (ssp->SR & BIT2) {	// Read while Rx FIFO not empty
+		ssp->DR;
+	}
+
+	if (rate != 0) {
+		SFPFunction *outFunc = SFPFunction_new();
+
+		if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+
+		SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+		SFPFunction_setID(outFunc, spi->fidBegin);
+		SFPFunction_setName(outFunc, spi->fnameBegin);
+		SFPFunction_addArgument_int32(outFunc, rate);
+		SFPFunction_send(outFunc, &stream);
+		SFPFunction_delete(outFunc);
 	}
 
 	return SFP_OK;
 }
 
-SFPResult lpc_spi0_trans(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 2)
+static uint8_t SPI_bounce[SPI_CHUNK_SIZE];	// Read data is sent out through this buffer
+
+static uint8_t SPI_SendChunk(uint8_t port, SFPFunction *msg, uint32_t size, uint32_t offset, uint32_t total) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+
+	SFPFunction *outFunc = SFPFunction_new();
+	if (outFunc == NULL) return 0;
+
+	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+	SFPFunction_setID(outFunc, spi->fidTrans);
+	SFPFunction_setName(outFunc, spi->fnameTrans);
+	SFPFunction_addArgument_barray(outFunc, SPI_bounce, size);
+	if (total > SPI_CHUNK_SIZE) {	// Chunked reply: (data, offset, total)
+		SFPFunction_addArgument_int32(outFunc, offset);
+		SFPFunction_addArgument_int32(outFunc, total);
+	}
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	return 1;
+}
+
+/*
+ * spiX_trans(data, read[, readFrames]): data holds one byte per frame, or two
+ * (little endian) for frames over 8 bits. readFrames more frames are clocked
+ * in after the data with all-ones dummy output. Read data comes back packed
+ * the same way, in SPI_CHUNK_SIZE replies if it doesn't fit in one. A reply
+ * that couldn't be allocated is missing and SFP_ERR_ALLOC_FAILED is returned.
+ */
+static SFPResult SPI_Trans(uint8_t port, SFPFunction *msg) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+	LPC_SSPx_Type *ssp = spi->ssp;
+
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE) return SFP_ERR_ARG_VALUE;	// Port is busy
+
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 2 && argCount != 3)
 		return SFP_ERR_ARG_COUNT;
 
 	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_BYTE_ARRAY
-			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT)
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| (argCount == 3 && SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT))
 		return SFP_ERR_ARG_TYPE;
 
-	uint32_t dataSize, writeSize;
+	uint32_t dataSize;
 	uint8_t *data = SFPFunction_getArgument_barray(msg, 0, &dataSize);
+	uint8_t requestRead =  SFPFunction_getArgument_int32(msg, 1) & 0x1;
+	uint32_t readFrames = (argCount == 3 ? SFPFunction_getArgument_int32(msg, 2) : 0);
+	uint8_t wide = (SPI_FRAME_BYTES(port) == 2);
 
-	uint32_t readSize = writeSize = dataSize;
-	uint8_t *readBuf = NULL, *readPtr = NULL;
+	if (wide && (dataSize & 1)) return SFP_ERR_ARG_VALUE;	// Frames are split
+	if (readFrames != 0 && !requestRead) return SFP_ERR_ARG_VALUE;
 
-	uint8_t requestRead =  SFPFunction_getArgument_int32(msg, 1) & 0x1;
-	if (requestRead) {
-		readBuf = (uint8_t*)MemoryManager_malloc(writeSize);
-		readPtr = readBuf;
+	uint32_t writeFrames = (wide ? dataSize/2 : dataSize);
+	uint32_t totalFrames = writeFrames + readFrames;
+	uint32_t total = (wide ? totalFrames*2 : totalFrames);	// Bytes of read data
+	uint32_t written = 0, read = 0, offset = 0, fill = 0;
+	uint8_t sendFailed = 0;
 
-		if (readBuf == NULL)
-			return SFP_ERR_ALLOC_FAILED;
+	while (written < totalFrames || read < totalFrames) {
+		// Keep at most a FIFO of frames in flight, so the Rx FIFO can't overrun while a chunk is sent
+		while (written < totalFrames && (written - read) < SPI_FIFO_DEPTH && (ssp->SR & BIT1)) { // Tx FIFO not full
+			if (written >= writeFrames) {
+				ssp->DR = 0xFFFF;	// Dummy
+			} else if (wide) {
+				ssp->DR = data[0] | (data[1] << 8);
+				data += 2;
+			} else {
+				ssp->DR = *data++;
+			}
+			written++;
+		}
+
+		while (read < written && (ssp->SR & BIT2)) { // Rx FIFO not empty
+			uint32_t tmp = ssp->DR;
+			read++;
+			if (!requestRead) continue;
+
+			SPI_bounce[fill++] = tmp;
+			if (wide)
+				SPI_bounce[fill++] = tmp >> 8;
+
+			if (fill == SPI_CHUNK_SIZE) {
+				if (!SPI_SendChunk(port, msg, fill, offset, total))
+					sendFailed = 1;	// The transfer goes on, the failure is returned at the end
+				offset += fill;
+				fill = 0;
+			}
+		}
+	}
+
+	if (requestRead && (fill != 0 || total == 0) && !SPI_SendChunk(port, msg, fill, offset, total))
+		sendFailed = 1;
+
+	return (sendFailed ? SFP_ERR_ALLOC_FAILED : SFP_OK);
+}
+
+/*
+ * Segmented transactions. Each segment starts with an op byte and a 16-bit
+ * little endian length:
+ *   SPI_SEG_WRITE    - length bytes of data follow, read data is dropped
+ *   SPI_SEG_EXCHANGE - length bytes of data follow, read data is kept
+ *   SPI_SEG_READ     - length frames of all-ones dummy output, read data is kept
+ *   SPI_SEG_DUMMY    - length frames of all-ones dummy output, read data is dropped
+ *   SPI_SEG_DELAY    - length us with the bus idle
+ * SPI_SEG_RELEASE in the op releases CS after the segment, it is asserted
+ * again before the next transfer segment.
+ */
+#define SPI_SEG_WRITE		0
+#define SPI_SEG_EXCHANGE	1
+#define SPI_SEG_READ		2
+#define SPI_SEG_DUMMY		3
+#define SPI_SEG_DELAY		4
+#define SPI_SEG_OP_MASK		0x7
+#define SPI_SEG_RELEASE		BIT7
+
+
+typedef struct {
+	uint8_t port;
+	uint32_t mask;	// 0 - no CS pin
+	uint8_t activeHigh;
+} SPI_ChipSelect;
+
+static void SPI_SetCS(SPI_ChipSelect *cs, uint8_t active) {
+	if (cs->mask == 0) return;
+
+	if (active == cs->activeHigh)
+		LPC_GPIO->SET[cs->port] = cs->mask;
+	else
+		LPC_GPIO->CLR[cs->port] = cs->mask;
+}
+
+static void SPI_InitCS(SPI_ChipSelect *cs, uint8_t pin, uint8_t activeHigh) {
+	cs->mask = 0;
+	if (pin == SPI_CS_NONE) return;
+
+	uint8_t pinNum = LPC_PIN_IDS[pin];
+	cs->port = 0;
+	if (pinNum > 23) {	// if not PIO0_0 to PIO0_23
+		cs->port = 1;
+		pinNum -= 24;
 	}
+	cs->mask = (1 << pinNum);
+	cs->activeHigh = activeHigh;
 
-	while (writeSize || readSize) {
-		while (writeSize && (LPC_SSP0->SR & BIT1)) { // Tx FIFO not full
-			LPC_SSP0->DR = *data++;
-			writeSize--;
+	SPI_SetCS(cs, 0);
+	LPC_GPIO->DIR[cs->port] |= cs->mask;
+}
+
+/*
+ * Clocks frames through the port. tx = NULL sends all-ones dummy frames,
+ * rx = NULL drops the read data.
+ */
+static void SPI_Exchange(LPC_SSPx_Type *ssp, uint8_t wide, const uint8_t *tx, uint8_t *rx, uint32_t frames) {
+	uint32_t written = 0, read = 0;
+
+	while (read < frames) {
+		while (written < frames && (written - read) < SPI_FIFO_DEPTH && (ssp->SR & BIT1)) { // Tx FIFO not full
+			if (tx == NULL) {
+				ssp->DR = 0xFFFF;
+			} else if (wide) {
+				ssp->DR = tx[0] | (tx[1] << 8);
+				tx += 2;
+			} else {
+				ssp->DR = *tx++;
+			}
+			written++;
 		}
 
-		while (readSize && (LPC_SSP0->SR & BIT2)) { // Rx FIFO not empty
-			uint32_t tmp = LPC_SSP0->DR;
-			readSize--;
-			if (readBuf != NULL)
-				*readPtr++ = tmp;
+		while (read < written && (ssp->SR & BIT2)) { // Rx FIFO not empty
+			uint32_t tmp = ssp->DR;
+			read++;
+			if (rx == NULL) continue;
+
+			*rx++ = tmp;
+			if (wide)
+				*rx++ = tmp >> 8;
 		}
 	}
+}
 
-	if (readBuf != NULL) {
-		SFPFunction *outFunc = SFPFunction_new();
+/*
+ * spiX_xfer(csPin, csMode, segments): runs the segments under csPin (SPI_CS_NONE -
+ * no CS pin), csMode SPI_CS_ACTIVE_HIGH selects the polarity. The kept read data
+ * of all segments is sent back in a single spiX_xfer(data) reply.
+ */
+static SFPResult SPI_Xfer(uint8_t port, SFPFunction *msg) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+
+	if (SFPFunction_getArgumentCount(msg) != 3)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_BYTE_ARRAY)
+		return SFP_ERR_ARG_TYPE;
+
+	uint8_t p_cs = SFPFunction_getArgument_int32(msg, 0);
+	uint8_t p_csMode = SFPFunction_getArgument_int32(msg, 1);
+	uint32_t segSize;
+	uint8_t *seg = SFPFunction_getArgument_barray(msg, 2, &segSize);
+	uint8_t wide = (SPI_FRAME_BYTES(port) == 2);
+
+	if (p_cs >= LPC_PIN_COUNT && p_cs != SPI_CS_NONE) return SFP_ERR_ARG_VALUE;
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE) return SFP_ERR_ARG_VALUE;	// Port is busy
+	if ((LPC_SYSCON->SYSAHBCLKCTRL & spi->clockBit) == 0) return SFP_ERR_ARG_VALUE;	// Not started
 
-		if (outFunc == NULL) {
-			MemoryManager_free(readBuf);
+	// Check the segments and size the read data before touching the bus
+	uint32_t pos = 0, readSize = 0;
+	while (pos < segSize) {
+		if (pos + 3 > segSize) return SFP_ERR_ARG_VALUE;
+
+		uint8_t op = seg[pos] & SPI_SEG_OP_MASK;
+		uint32_t len = seg[pos+1] | (seg[pos+2] << 8);
+		pos += 3;
+
+		switch (op) {
+		case SPI_SEG_WRITE:
+		case SPI_SEG_EXCHANGE:
+			if (pos + len > segSize || (wide && (len & 1))) return SFP_ERR_ARG_VALUE;
+			pos += len;
+			if (op == SPI_SEG_EXCHANGE) readSize += len;
+			break;
+		case SPI_SEG_READ:
+			readSize += (wide ? len*2 : len);
+			break;
+		case SPI_SEG_DUMMY:
+		case SPI_SEG_DELAY:
+			break;
+		default:
+			return SFP_ERR_ARG_VALUE;
+		}
+	}
+
+	uint8_t *readData = NULL;
+	if (readSize != 0) {
+		readData = MemoryManager_malloc(readSize);
+		if (readData == NULL)
 			return SFP_ERR_ALLOC_FAILED;
+	}
+
+	SPI_ChipSelect cs;
+	SPI_InitCS(&cs, p_cs, (p_csMode & SPI_CS_ACTIVE_HIGH) ? 1 : 0);
+
+	uint8_t *rx = readData;
+	uint8_t asserted = 0;
+	pos = 0;
+	while (pos < segSize) {
+		uint8_t op = seg[pos] & SPI_SEG_OP_MASK;
+		uint8_t release = seg[pos] & SPI_SEG_RELEASE;
+		uint32_t len = seg[pos+1] | (seg[pos+2] << 8);
+		pos += 3;
+
+		if (op == SPI_SEG_DELAY) {
+			time_us_t end = Time_getAlarmTime() + len;
+			while ((int32_t)(Time_getAlarmTime() - end) < 0);
+		} else {
+			if (!asserted) {
+				SPI_SetCS(&cs, 1);
+				asserted = 1;
+			}
+
+			switch (op) {
+			case SPI_SEG_WRITE:
+				SPI_Exchange(spi->ssp, wide, &seg[pos], NULL, (wide ? len/2 : len));
+				pos += len;
+				break;
+			case SPI_SEG_EXCHANGE:
+				SPI_Exchange(spi->ssp, wide, &seg[pos], rx, (wide ? len/2 : len));
+				pos += len;
+				rx += len;
+				break;
+			case SPI_SEG_READ:
+				SPI_Exchange(spi->ssp, wide, NULL, rx, len);
+				rx += (wide ? len*2 : len);
+				break;
+			case SPI_SEG_DUMMY:
+				SPI_Exchange(spi->ssp, wide, NULL, NULL, len);
+				break;
+			}
+		}
+
+		if (release && asserted) {
+			SPI_SetCS(&cs, 0);
+			asserted = 0;
 		}
+	}
 
+	if (asserted)
+		SPI_SetCS(&cs, 0);
+
+	SFPResult res = SFP_OK;
+	SFPFunction *outFunc = SFPFunction_new();
+	if (outFunc != NULL) {
 		SFPFunction_setType(outFunc, SFPFunction_getType(msg));
-		SFPFunction_setID(outFunc, UPER_FID_SPI0TRANS);
-		SFPFunction_setName(outFunc, UPER_FNAME_SPI0TRANS);
-		SFPFunction_addArgument_barray(outFunc, readBuf, dataSize);
+		SFPFunction_setID(outFunc, spi->fidXfer);
+		SFPFunction_setName(outFunc, spi->fnameXfer);
+		SFPFunction_addArgument_barray(outFunc, readData, readSize);
 		SFPFunction_send(outFunc, &stream);
 		SFPFunction_delete(outFunc);
+	} else {
+		res = SFP_ERR_ALLOC_FAILED;
+	}
 
-		MemoryManager_free(readBuf);
+	if (readData != NULL)
+		MemoryManager_free(readData);
+
+	return res;
+}
+
+uint8_t SPI_Transfer(uint8_t port, uint8_t csPin, uint8_t csActiveHigh,
+		const uint8_t *write, uint32_t writeSize, uint8_t *read, uint32_t readSize) {
+	if (port >= SPI_PORT_COUNT || (csPin >= LPC_PIN_COUNT && csPin != SPI_CS_NONE)) return 1;
+
+	const SPI_Port *spi = &SPI_PORTS[port];
+	uint8_t wide = (SPI_FRAME_BYTES(port) == 2);
+
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE) return 1;	// Port is busy
+	if ((LPC_SYSCON->SYSAHBCLKCTRL & spi->clockBit) == 0) return 1;	// Not started
+	if (wide && ((writeSize | readSize) & 1)) return 1;	// Frames are split
+
+	SPI_ChipSelect cs;
+	SPI_InitCS(&cs, csPin, csActiveHigh);
+
+	SPI_SetCS(&cs, 1);
+	SPI_Exchange(spi->ssp, wide, write, NULL, (wide ? writeSize/2 : writeSize));
+	SPI_Exchange(spi->ssp, wide, NULL, read, (wide ? readSize/2 : readSize));
+	SPI_SetCS(&cs, 0);
+
+	return 0;
+}
+
+static void SPI_AsyncFill(uint8_t port) {
+	LPC_SSPx_Type *ssp = SPI_PORTS[port].ssp;
+	uint32_t written = SPIAsync[port].written;
+	uint32_t frames = SPIAsync[port].frames;
+
+	while (written < frames && (written - SPIAsync[port].received) < SPI_FIFO_DEPTH && (ssp->SR & BIT1)) { // Tx FIFO not full
+		uint8_t *ptr = &SPIAsync[port].buffer[SPIAsync[port].wide ? written*2 : written];
+		ssp->DR = (SPIAsync[port].wide ? ptr[0] | (ptr[1] << 8) : ptr[0]);
+		written++;
 	}
 
-	return SFP_OK;
+	SPIAsync[port].written = written;
 }
 
-SFPResult lpc_spi0_end(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 0)
-		return SFP_ERR_ARG_COUNT;
+static void SPI_AsyncStop(uint8_t port) {
+	const SPI_Port *spi = &SPI_PORTS[port];
 
-	LPC_SSP0->CR1 = 0;		// SPI disabled
-	LPC_SYSCON->SYSAHBCLKCTRL &= ~BIT11;	// disable SPI0 clock
-	LPC_SYSCON->PRESETCTRL &= ~1; 			// assert SPI0
+	NVIC_DisableIRQ(spi->irq);
+	spi->ssp->IMSC = 0;		// Interrupts disabled
 
-	return SFP_OK;
+	if (SPIAsync[port].status == SPI_ASYNC_SLAVE) {
+		GPIO_FreeInterrupt(SPISlave.intID);
+		*LPC_PIN_REGISTERS[spi->sselPin] = SPISlave.sselConfig;
+		spi->ssp->CR1 = 0;	// SPI disabled
+		SPISlave.port = SPI_SLAVE_NONE;
+	}
+
+	if (SPIAsync[port].buffer != NULL)
+		MemoryManager_free(SPIAsync[port].buffer);
+	SPIAsync[port].buffer = NULL;
+	SPIAsync[port].status = SPI_ASYNC_IDLE;
+}
+
+static void SPI_SlaveFill(uint8_t port) {
+	LPC_SSPx_Type *ssp = SPI_PORTS[port].ssp;
+	uint32_t cursor = SPIAsync[port].written;
+
+	while (ssp->SR & BIT1) { // Tx FIFO not full
+		uint8_t *ptr = &SPIAsync[port].buffer[SPIAsync[port].wide ? cursor*2 : cursor];
+		ssp->DR = (SPIAsync[port].wide ? ptr[0] | (ptr[1] << 8) : ptr[0]);
+		if (++cursor == SPIAsync[port].frames)
+			cursor = 0;
+	}
+
+	SPIAsync[port].written = cursor;
+}
+
+static void SPI_SlaveInterrupt(uint8_t port) {
+	LPC_SSPx_Type *ssp = SPI_PORTS[port].ssp;
+	uint8_t frameBytes = (SPIAsync[port].wide ? 2 : 1);
+	time_us_t now = Time_getAlarmTime();
+
+	while (ssp->SR & BIT2) { // Rx FIFO not empty
+		uint32_t tmp = ssp->DR;
+		uint8_t bh = SPISlave.burstHead;
+		SPI_SlaveBurst *burst = (SPI_SlaveBurst*)&SPISlave.bursts[(bh-1) & (SPI_SLAVE_BURST_COUNT-1)];
+
+		if ((uint16_t)(SPISlave.head - SPISlave.tail) > SPI_SLAVE_RING_SIZE - frameBytes) {
+			SPISlave.dropped++;
+			continue;
+		}
+
+		if (bh == SPISlave.burstTail || SPISlave.closed || (now - burst->last) >= SPISlave.gap
+				|| burst->size + frameBytes > SPI_CHUNK_SIZE) {
+			if ((uint8_t)(bh - SPISlave.burstTail) == SPI_SLAVE_BURST_COUNT) {
+				SPISlave.dropped++;
+				continue;
+			}
+
+			burst = (SPI_SlaveBurst*)&SPISlave.bursts[bh & (SPI_SLAVE_BURST_COUNT-1)];
+			burst->time = now;
+			burst->size = 0;
+			SPISlave.burstHead = bh + 1;
+			SPISlave.closed = 0;
+		}
+
+		SPISlave.data[SPISlave.head++ & (SPI_SLAVE_RING_SIZE-1)] = tmp;
+		if (frameBytes == 2)
+			SPISlave.data[SPISlave.head++ & (SPI_SLAVE_RING_SIZE-1)] = tmp >> 8;
+		burst->size += frameBytes;
+		burst->last = now;
+	}
+
+	uint32_t overrun = ssp->RIS & BIT0;
+	if (overrun)	// The Rx FIFO overran, at least one frame is lost
+		SPISlave.dropped++;
+	ssp->ICR = overrun | BIT1;	// Clear the overrun counted above and the timeout
+
+	if (SPIAsync[port].frames != 0)
+		SPI_SlaveFill(port);
 }
 
 /*
- * SPI1
+ * (Re)starts the SSP in slave mode. The block reset is the only way to flush
+ * the Tx FIFO, the response starts over from its first frame.
  */
-SFPResult lpc_spi1_begin(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 2)
+static void SPI_SlaveConfig(uint8_t port) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+	LPC_SSPx_Type *ssp = spi->ssp;
+	uint8_t respond = (SPIAsync[port].frames != 0);
+
+	LPC_SYSCON->PRESETCTRL &= ~spi->resetBit;	// reset SPIx
+	LPC_SYSCON->PRESETCTRL |= spi->resetBit;
+
+	ssp->CR1 = 0;
+	ssp->CPSR = 2;
+	ssp->CR0 = SPISlave.cr0;
+	ssp->CR1 = BIT2 | (respond ? 0 : BIT3);	// Slave mode, output disabled when only listening
+
+	SPIAsync[port].written = 0;		// Response cursor
+	if (respond)
+		SPI_SlaveFill(port);
+
+	ssp->ICR = BIT0 | BIT1;
+	ssp->IMSC = BIT0 | BIT1 | BIT2 | (respond ? BIT3 : 0);	// Rx overrun, timeout, half full, Tx half empty
+	ssp->CR1 |= BIT1;	// SPI enabled
+}
+
+static void SPI_SlaveSelectHandler(uint8_t intID) {	// SSEL rising edge, pin interrupt priority
+	LPC_GPIO_PIN_INT->RISE = (1 << intID);	// Clear rising edge (sort of) flag
+
+	uint8_t port = SPISlave.port;
+	if (port == SPI_SLAVE_NONE) return;
+
+	IRQn_Type irq = SPI_PORTS[port].irq;
+	NVIC_DisableIRQ(irq);		// The SSP ISR preempts this one
+	SPI_SlaveInterrupt(port);	// Frames of the ended transaction
+	SPISlave.closed = 1;
+	SPI_SlaveConfig(port);
+	NVIC_EnableIRQ(irq);
+}
+
+static void SPI_SlaveProcess(void) {
+	uint8_t port = SPISlave.port;
+	if (port == SPI_SLAVE_NONE) return;
+
+	const SPI_Port *spi = &SPI_PORTS[port];
+
+	while (SPISlave.burstTail != SPISlave.burstHead) {
+		SPI_SlaveBurst burst;
+		uint8_t bt = SPISlave.burstTail;
+
+		__disable_irq();	// The newest burst may still be growing
+		burst = *(SPI_SlaveBurst*)&SPISlave.bursts[bt & (SPI_SLAVE_BURST_COUNT-1)];
+		uint8_t closed = ((uint8_t)(bt + 1) != SPISlave.burstHead || SPISlave.closed
+				|| (Time_getAlarmTime() - burst.last) >= SPISlave.gap);
+		__enable_irq();
+
+		if (!closed) break;
+
+		uint16_t i, tail = SPISlave.tail;
+		for (i=0; i<burst.size; i++)
+			SPI_bounce[i] = SPISlave.data[tail++ & (SPI_SLAVE_RING_SIZE-1)];
+
+		SFPFunction *outFunc = SFPFunction_new();
+		if (outFunc == NULL) return;	// Try again later
+
+		SFPFunction_setType(outFunc, SPIAsync[port].type);
+		SFPFunction_setID(outFunc, spi->fidSlave);
+		SFPFunction_setName(outFunc, spi->fnameSlave);
+		SFPFunction_addArgument_int32(outFunc, burst.time);
+		SFPFunction_addArgument_barray(outFunc, SPI_bounce, burst.size);
+		SFPFunction_addArgument_int32(outFunc, SPISlave.dropped);
+		SFPFunction_send(outFunc, &stream);
+		SFPFunction_delete(outFunc);
+
+		SPISlave.dropped = 0;	// Frames dropped after this are counted for the next burst
+		SPISlave.tail = tail;
+		SPISlave.burstTail = bt + 1;
+	}
+}
+
+/*
+ * spiX_slave(mode, frameBits, response[, gap]): response frames are packed like
+ * spiX_trans data, an empty response only listens. SSEL is SPI0 - pin 1
+ * (PIO0_2), SPI1 - pin 6 (PIO1_23). Captured bursts are sent as
+ * spiX_slave(time, data, dropped). spiX_end leaves slave mode.
+ */
+static SFPResult SPI_Slave(uint8_t port, SFPFunction *msg) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+
+	uint32_t argCount = SFPFunction_getArgumentCount(msg);
+	if (argCount != 3 && argCount != 4)
 		return SFP_ERR_ARG_COUNT;
 
 	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT
-			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT)
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_BYTE_ARRAY
+			|| (argCount == 4 && SFPFunction_getArgumentType(msg, 3) != SFP_ARG_INT))
 		return SFP_ERR_ARG_TYPE;
 
-	uint32_t divider = (SFPFunction_getArgument_int32(msg, 0)-1) & 0xFF;
-	uint32_t mode = SFPFunction_getArgument_int32(msg, 1) & 0x3;
+	uint32_t mode = SFPFunction_getArgument_int32(msg, 0) & 0x3;
+	uint32_t p_frameBits = SFPFunction_getArgument_int32(msg, 1);
+	uint32_t responseSize;
+	uint8_t *response = SFPFunction_getArgument_barray(msg, 2, &responseSize);
+	uint32_t p_gap = (argCount == 4 ? SFPFunction_getArgument_int32(msg, 3) : SPI_SLAVE_GAP_DEFAULT);
+	uint8_t wide = (p_frameBits > 8);
 
-	LPC_SYSCON->PRESETCTRL |= BIT2; 	// de-assert SPI1
-	LPC_SYSCON->SYSAHBCLKCTRL |= BIT18;	// enable SPI1 clock
-	LPC_SYSCON->SSP1CLKDIV = 1; 		//48MHz
+	if (p_frameBits < 4 || p_frameBits > 16 || (wide && (responseSize & 1)) || p_gap == 0)
+		return SFP_ERR_ARG_VALUE;
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE || SPISlave.port != SPI_SLAVE_NONE)
+		return SFP_ERR_ARG_VALUE;	// Busy, or the other port is a slave already
 
+	int8_t intID = GPIO_AllocInterrupt(SPI_SlaveSelectHandler);
+	if (intID < 0) return SFP_ERR_ARG_VALUE;	// SSEL edges need a pin interrupt channel
 
-	LPC_SSP1->CR1 = 0;		// Master mode, SPI disabled
-	LPC_SSP1->CPSR = 24;	// 48MHz/24 = 2MHz
-	LPC_SSP1->CR0 = (0x7) | (0 << 4) | (mode << 6) | (divider << 8); // 8bits, SPI mode x
-	LPC_SSP1->IMSC = 0;		// Interrupts disabled
-	LPC_SSP1->CR1 = BIT1;	//Master mode, SPI enabled
+	uint8_t *buffer = NULL;
+	if (responseSize != 0) {
+		buffer = MemoryManager_malloc(responseSize);
+		if (buffer == NULL) {
+			GPIO_FreeInterrupt(intID);
+			return SFP_ERR_ALLOC_FAILED;
+		}
+		memcpy(buffer, response, responseSize);
+	}
 
-	while (LPC_SSP1->SR & BIT4);	// wait while BUSY (reading or writing)
+	SPIAsync[port].buffer = buffer;
+	SPIAsync[port].wide = wide;
+	SPIAsync[port].frames = (wide ? responseSize/2 : responseSize);
+	SPIAsync[port].type = SFPFunction_getType(msg);
+	SPIAsync[port].status = SPI_ASYNC_SLAVE;
 
-	while (LPC_SSP1->SR & BIT2) {	// Read while Rx FIFO not empty
-		LPC_SSP1->DR;
-	}
+	SPISlave.intID = intID;
+	SPISlave.cr0 = (p_frameBits - 1) | (0 << 4) | (mode << 6);	// x bits, SPI mode x
+	SPISlave.closed = 0;
+	SPISlave.gap = p_gap;
+	SPISlave.head = SPISlave.tail = 0;
+	SPISlave.burstHead = SPISlave.burstTail = 0;
+	SPISlave.dropped = 0;
+	SPISlave.port = port;
+
+	LPC_SYSCON->PRESETCTRL |= spi->resetBit; 		// de-assert SPIx
+	LPC_SYSCON->SYSAHBCLKCTRL |= spi->clockBit;	// enable SPIx clock
+	*spi->clkdiv = 1;	// 48MHz, the master clock must stay below 1/12 of it
+	SPI_frameBits[port] = p_frameBits;
+
+	volatile uint32_t *ssel = LPC_PIN_REGISTERS[spi->sselPin];
+	SPISlave.sselConfig = *ssel;
+	*ssel = (*ssel & ~(BIT7 | 7)) | BIT7 | spi->sselFunction;	// Digital mode, SSEL function
+
+	SPI_SlaveConfig(port);
+	NVIC_SetPriority(spi->irq, 2);
+	NVIC_EnableIRQ(spi->irq);
+
+	GPIO_ConfigInterrupt(intID, spi->sselPin, 3);	// Rising edge: transaction ended
 
 	return SFP_OK;
 }
 
-SFPResult lpc_spi1_trans(SFPFunction *msg) {
-	if (SFPFunction_getArgumentCount(msg) != 2)
+static void SPI_InterruptHandler(uint8_t port) {
+	LPC_SSPx_Type *ssp = SPI_PORTS[port].ssp;
+	uint32_t received = SPIAsync[port].received;
+
+	if (SPIAsync[port].status == SPI_ASYNC_SLAVE) {
+		SPI_SlaveInterrupt(port);
+		return;
+	}
+
+	while (received < SPIAsync[port].written && (ssp->SR & BIT2)) { // Rx FIFO not empty
+		uint32_t tmp = ssp->DR;
+		uint8_t *ptr = &SPIAsync[port].buffer[SPIAsync[port].wide ? received*2 : received];
+
+		ptr[0] = tmp;	// The frame was written already, its place is free
+		if (SPIAsync[port].wide)
+			ptr[1] = tmp >> 8;
+		received++;
+	}
+
+	SPIAsync[port].received = received;
+	ssp->ICR = BIT1;	// Clear Rx timeout
+
+	if (received == SPIAsync[port].frames) {
+		ssp->IMSC = 0;
+		SPIAsync[port].status = SPI_ASYNC_DONE;	// Reported by SPI_Process
+	} else {
+		SPI_AsyncFill(port);
+	}
+}
+
+void SSP0_IRQHandler(void) {
+	SPI_InterruptHandler(0);
+}
+
+void SSP1_IRQHandler(void) {
+	SPI_InterruptHandler(1);
+}
+
+/*
+ * spiX_start(data, read, tag): same as spiX_trans, but runs in the background.
+ * spiX_done(tag[, data, offset, total]) is sent once the transfer ends.
+ */
+static SFPResult SPI_Start(uint8_t port, SFPFunction *msg) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+
+	if (SFPFunction_getArgumentCount(msg) != 3)
 		return SFP_ERR_ARG_COUNT;
 
 	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_BYTE_ARRAY
-			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT)
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT
+			|| SFPFunction_getArgumentType(msg, 2) != SFP_ARG_INT)
 		return SFP_ERR_ARG_TYPE;
 
-	uint32_t dataSize, writeSize;
+	uint32_t dataSize;
 	uint8_t *data = SFPFunction_getArgument_barray(msg, 0, &dataSize);
+	uint8_t wide = (SPI_FRAME_BYTES(port) == 2);
 
-	uint32_t readSize = writeSize = dataSize;
-	uint8_t *readBuf = NULL, *readPtr = NULL;
+	if (dataSize == 0 || (wide && (dataSize & 1))) return SFP_ERR_ARG_VALUE;
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE) return SFP_ERR_ARG_VALUE;	// One transfer at a time
+	if ((LPC_SYSCON->SYSAHBCLKCTRL & spi->clockBit) == 0) return SFP_ERR_ARG_VALUE;	// Not started
 
-	uint8_t requestRead =  SFPFunction_getArgument_int32(msg, 1) & 0x1;
-	if (requestRead) {
-		readBuf = (uint8_t*)MemoryManager_malloc(writeSize);
-		readPtr = readBuf;
+	uint8_t *buffer = MemoryManager_malloc(dataSize);
+	if (buffer == NULL)
+		return SFP_ERR_ALLOC_FAILED;
+	memcpy(buffer, data, dataSize);
 
-		if (readBuf == NULL)
-			return SFP_ERR_ALLOC_FAILED;
-	}
+	SPIAsync[port].buffer = buffer;
+	SPIAsync[port].wide = wide;
+	SPIAsync[port].read = SFPFunction_getArgument_int32(msg, 1) & 0x1;
+	SPIAsync[port].tag = SFPFunction_getArgument_int32(msg, 2);
+	SPIAsync[port].frames = (wide ? dataSize/2 : dataSize);
+	SPIAsync[port].written = 0;
+	SPIAsync[port].received = 0;
+	SPIAsync[port].sent = 0;
+	SPIAsync[port].type = SFPFunction_getType(msg);
+	SPIAsync[port].status = SPI_ASYNC_BUSY;
 
-	while (writeSize || readSize) {
-		while (writeSize && (LPC_SSP1->SR & BIT1)) { // Tx FIFO not full
-			LPC_SSP1->DR = *data++;
-			writeSize--;
-		}
+	NVIC_DisableIRQ(spi->irq);
+	SPI_AsyncFill(port);
+	spi->ssp->ICR = BIT1;	// Clear Rx timeout
+	spi->ssp->IMSC = BIT1 | BIT2;	// Rx timeout and Rx half full
+	NVIC_SetPriority(spi->irq, 2);
+	NVIC_EnableIRQ(spi->irq);
 
-		while (readSize && (LPC_SSP1->SR & BIT2)) { // Rx FIFO not empty
-			uint32_t tmp = LPC_SSP1->DR;
-			readSize--;
-			if (readBuf != NULL)
-				*readPtr++ = tmp;
-		}
-	}
+	return SFP_OK;
+}
+
+/*
+ * Returns 1 once the whole reply is sent. If a message can't be allocated,
+ * the rest is sent by a later SPI_Process call.
+ */
+static uint8_t SPI_SendDone(uint8_t port) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+	uint32_t total = (SPIAsync[port].wide ? SPIAsync[port].frames*2 : SPIAsync[port].frames);
+	uint32_t offset = SPIAsync[port].sent;
+
+	do {
+		uint32_t size = total - offset;
+		if (size > SPI_CHUNK_SIZE) size = SPI_CHUNK_SIZE;
 
-	if (readBuf != NULL) {
 		SFPFunction *outFunc = SFPFunction_new();
+		if (outFunc == NULL) return 0;	// Retried from offset
 
-		if (outFunc == NULL) {
-			MemoryManager_free(readBuf);
-			return SFP_ERR_ALLOC_FAILED;
+		SFPFunction_setType(outFunc, SPIAsync[port].type);
+		SFPFunction_setID(outFunc, spi->fidDone);
+		SFPFunction_setName(outFunc, spi->fnameDone);
+		SFPFunction_addArgument_int32(outFunc, SPIAsync[port].tag);
+		if (SPIAsync[port].read) {
+			SFPFunction_addArgument_barray(outFunc, &SPIAsync[port].buffer[offset], size);
+			SFPFunction_addArgument_int32(outFunc, offset);
+			SFPFunction_addArgument_int32(outFunc, total);
 		}
-
-		SFPFunction_setType(outFunc, SFPFunction_getType(msg));
-		SFPFunction_setID(outFunc, UPER_FID_SPI1TRANS);
-		SFPFunction_setName(outFunc, UPER_FNAME_SPI1TRANS);
-		SFPFunction_addArgument_barray(outFunc, readBuf, dataSize);
 		SFPFunction_send(outFunc, &stream);
 		SFPFunction_delete(outFunc);
 
-		MemoryManager_free(readBuf);
-	}
+		offset += size;
+		SPIAsync[port].sent = offset;
+	} while (SPIAsync[port].read && offset < total);
 
-	return SFP_OK;
+	return 1;
 }
 
-SFPResult lpc_spi1_end(SFPFunction *msg) {
+void SPI_Process(void) {
+	uint8_t port;
+
+	SPI_SlaveProcess();
+
+	for (port=0; port<SPI_PORT_COUNT; port++) {
+		if (SPIAsync[port].status == SPI_ASYNC_DONE && SPI_SendDone(port))
+			SPI_AsyncStop(port);	// Buffer is kept until the reply is complete
+	}
+}
+
+static SFPResult SPI_End(uint8_t port, SFPFunction *msg) {
+	const SPI_Port *spi = &SPI_PORTS[port];
+
 	if (SFPFunction_getArgumentCount(msg) != 0)
 		return SFP_ERR_ARG_COUNT;
 
-	LPC_SSP1->CR1 = 0;		// SPI disabled
-	LPC_SYSCON->SYSAHBCLKCTRL &= ~BIT18;	// disable SPI1 clock
-	LPC_SYSCON->PRESETCTRL &= ~BIT2;		// assert SPI1
+	if (SPIAsync[port].status != SPI_ASYNC_IDLE)	// Abort the background transfer
+		SPI_AsyncStop(port);
+
+	spi->ssp->CR1 = 0;		// SPI disabled
+	LPC_SYSCON->SYSAHBCLKCTRL &= ~spi->clockBit;	// disable SPIx clock
+	LPC_SYSCON->PRESETCTRL &= ~spi->resetBit;		// assert SPIx
 
 	return SFP_OK;
 }
+
+/*
+ * SPI0
+ */
+SFPResult lpc_spi0_begin(SFPFunction *msg) {
+	return SPI_Begin(0, msg);
+}
+
+SFPResult lpc_spi0_trans(SFPFunction *msg) {
+	return SPI_Trans(0, msg);
+}
+
+SFPResult lpc_spi0_xfer(SFPFunction *msg) {
+	return SPI_Xfer(0, msg);
+}
+
+SFPResult lpc_spi0_slave(SFPFunction *msg) {
+	return SPI_Slave(0, msg);
+}
+
+SFPResult lpc_spi0_start(SFPFunction *msg) {
+	return SPI_Start(0, msg);
+}
+
+SFPResult lpc_spi0_end(SFPFunction *msg) {
+	return SPI_End(0, msg);
+}
+
+/*
+ * SPI1
+ */
+SFPResult lpc_spi1_begin(SFPFunction *msg) {
+	return SPI_Begin(1, msg);
+}
+
+SFPResult lpc_spi1_trans(SFPFunction *msg) {
+	return SPI_Trans(1, msg);
+}
+
+SFPResult lpc_spi1_xfer(SFPFunction *msg) {
+	return SPI_Xfer(1, msg);
+}
+
+SFPResult lpc_spi1_slave(SFPFunction *msg) {
+	return SPI_Slave(1, msg);
+}
+
+SFPResult lpc_spi1_start(SFPFunction *msg) {
+	return SPI_Start(1, msg);
+}
+
+SFPResult lpc_spi1_end(SFPFunction *msg) {
+	return SPI_End(1, msg);
+}
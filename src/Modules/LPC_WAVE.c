@@ -0,0 +1,293 @@
+/**
+ * @file	LPC_WAVE.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+
+#include "Modules/LPC_WAVE.h"
+#include "Modules/LPC_GPIO.h"
+
+#define WAVE_MIN_DELAY	10	// Minimum step length in microseconds, above the cost of a step in the alarm ISR
+#define WAVE_MAX_CATCHUP	4	// Late steps played by a single alarm, the rest of the wave is delayed
+
+typedef struct {
+	uint32_t set[2];	// SET register values for port 0 and 1
+	uint32_t clr[2];	// CLR register values for port 0 and 1
+	uint32_t delay;		// Time until the next step in microseconds
+} WaveStep;
+
+volatile struct {
+	WaveStep *buffer[2];
+	uint32_t capacity;		// Number of steps in each buffer
+	uint32_t length[2];		// Number of loaded steps, 0 - buffer is free
+
+	uint8_t loadBuffer;		// Buffer to be filled by the next wave_load
+	uint8_t playBuffer;		// Buffer being played
+	uint32_t position;		// Current step in the played buffer
+
+	uint8_t running;
+	uint8_t loop;
+	time_us_t nextTime;		// Alarm time of the current step
+
+	uint8_t pinCount;
+	uint8_t pinIDs[WAVE_MAX_PINS];	// Pin IDs as in LPC_PIN_IDS
+} WaveHandler;
+
+static inline uint32_t WAVE_readUint32(uint8_t *ptr) {
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (ptr[3] << 24);
+}
+
+static void WAVE_Play(void *param) {
+	uint32_t steps = 0;
+
+	do {
+		WaveStep *step = &WaveHandler.buffer[WaveHandler.playBuffer][WaveHandler.position];
+
+		LPC_GPIO->SET[0] = step->set[0];
+		LPC_GPIO->CLR[0] = step->clr[0];
+		LPC_GPIO->SET[1] = step->set[1];
+		LPC_GPIO->CLR[1] = step->clr[1];
+
+		WaveHandler.nextTime += step->delay;
+
+		if (++WaveHandler.position >= WaveHandler.length[WaveHandler.playBuffer]) {
+			uint8_t nextBuffer = WaveHandler.playBuffer ^ 1;
+
+			WaveHandler.position = 0;
+
+			if (WaveHandler.length[nextBuffer] != 0) {	// Refilled buffer is waiting - release the played one
+				WaveHandler.length[WaveHandler.playBuffer] = 0;
+				WaveHandler.playBuffer = nextBuffer;
+			} else if (!WaveHandler.loop) {				// Nothing left to play
+				WaveHandler.length[WaveHandler.playBuffer] = 0;
+				WaveHandler.running = 0;
+				return;
+			}
+		}
+	} while (++steps < WAVE_MAX_CATCHUP
+			&& (int32_t)(WaveHandler.nextTime - Time_getAlarmTime()) <= 0);	// Catch up with steps which are already due
+
+	if ((int32_t)(WaveHandler.nextTime - Time_getAlarmTime()) <= 0)	// Still late - shift the wave instead of starving other interrupts
+		WaveHandler.nextTime = Time_getAlarmTime() + WAVE_MIN_DELAY;
+
+	Time_setAlarm(TIME_ALARM_WAVE, WaveHandler.nextTime, WAVE_Play, NULL);
+}
+
+static void WAVE_Stop(void) {
+	Time_clearAlarm(TIME_ALARM_WAVE);
+
+	WaveHandler.running = 0;
+	WaveHandler.length[0] = 0;
+	WaveHandler.length[1] = 0;
+	WaveHandler.loadBuffer = 0;
+	WaveHandler.playBuffer = 0;
+	WaveHandler.position = 0;
+}
+
+static void WAVE_Free(void) {
+	WAVE_Stop();
+
+	if (WaveHandler.buffer[0] != NULL)
+		MemoryManager_free(WaveHandler.buffer[0]);
+	if (WaveHandler.buffer[1] != NULL)
+		MemoryManager_free(WaveHandler.buffer[1]);
+	WaveHandler.buffer[0] = NULL;
+	WaveHandler.buffer[1] = NULL;
+	WaveHandler.capacity = 0;
+	WaveHandler.pinCount = 0;
+}
+
+SFPResult lpc_wave_begin(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 2)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_BYTE_ARRAY
+			|| SFPFunction_getArgumentType(msg, 1) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	uint32_t pinCount, i;
+	uint8_t *pins = SFPFunction_getArgument_barray(msg, 0, &pinCount);
+	uint32_t capacity = SFPFunction_getArgument_int32(msg, 1);	// Steps per buffer
+
+	if (pinCount == 0 || pinCount > WAVE_MAX_PINS || capacity == 0)
+		return SFP_ERR_ARG_VALUE;
+
+	for (i=0; i<pinCount; i++) {  // Check argument values before any changes
+		if (pins[i] >= LPC_PIN_COUNT)
+			return SFP_ERR_ARG_VALUE;
+	}
+
+	WAVE_Free();
+
+	WaveHandler.buffer[0] = (WaveStep*)MemoryManager_malloc(capacity*sizeof(WaveStep));
+	WaveHandler.buffer[1] = (WaveStep*)MemoryManager_malloc(capacity*sizeof(WaveStep));
+
+	if (WaveHandler.buffer[0] == NULL || WaveHandler.buffer[1] == NULL) {
+		WAVE_Free();
+		return SFP_ERR_ALLOC_FAILED;
+	}
+
+	WaveHandler.capacity = capacity;
+	WaveHandler.pinCount = pinCount;
+
+	for (i=0; i<pinCount; i++) {
+		uint8_t pin = pins[i];
+
+		uint8_t port = 0;
+		uint8_t pinNum = LPC_PIN_IDS[pin];
+		if (pinNum > 23) {	// if not PIO0_0 to PIO0_23
+			port = 1;
+			pinNum -= 24;
+		}
+
+		WaveHandler.pinIDs[i] = LPC_PIN_IDS[pin];
+		LPC_GPIO->DIR[port] |= (1 << pinNum);	// Set direction bit (output)
+	}
+
+	return SFP_OK;
+}
+
+SFPResult lpc_wave_load(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_BYTE_ARRAY)
+		return SFP_ERR_ARG_TYPE;
+
+	uint32_t dataSize, i, n;
+	uint8_t *data = SFPFunction_getArgument_barray(msg, 0, &dataSize);
+	uint32_t stepCount = dataSize / WAVE_STEP_SIZE;
+
+	if (WaveHandler.capacity == 0)	// wave_begin was not called
+		return SFP_ERR_ARG_VALUE;
+
+	if (stepCount == 0 || stepCount > WaveHandler.capacity || (dataSize % WAVE_STEP_SIZE) != 0)
+		return SFP_ERR_ARG_VALUE;
+
+	for (i=0; i<stepCount; i++) {  // Check argument values before any changes
+		if (WAVE_readUint32(&data[i*WAVE_STEP_SIZE + 8]) < WAVE_MIN_DELAY)
+			return SFP_ERR_ARG_VALUE;
+	}
+
+	uint32_t accepted = 0;
+	uint8_t bufferID = WaveHandler.loadBuffer;
+
+	if (WaveHandler.length[bufferID] == 0) {	// Buffer was released by the player
+		WaveStep *step = WaveHandler.buffer[bufferID];
+
+		for (i=0; i<stepCount; i++, step++, data += WAVE_STEP_SIZE) {
+			uint32_t mask = WAVE_readUint32(&data[0]);
+			uint32_t values = WAVE_readUint32(&data[4]);
+
+			step->set[0] = step->set[1] = 0;
+			step->clr[0] = step->clr[1] = 0;
+			step->delay = WAVE_readUint32(&data[8]);
+
+			for (n=0; n<WaveHandler.pinCount; n++) {
+				if (!(mask & (1 << n)))
+					continue;
+
+				uint8_t port = 0;
+				uint8_t pinNum = WaveHandler.pinIDs[n];
+				if (pinNum > 23) {	// if not PIO0_0 to PIO0_23
+					port = 1;
+					pinNum -= 24;
+				}
+
+				if (values & (1 << n))
+					step->set[port] |= (1 << pinNum);
+				else
+					step->clr[port] |= (1 << pinNum);
+			}
+		}
+
+		WaveHandler.length[bufferID] = stepCount;	// Hand the buffer over to the player
+		WaveHandler.loadBuffer = bufferID ^ 1;
+		accepted = stepCount;
+	}
+
+	SFPFunction *outFunc = SFPFunction_new();
+
+	if (outFunc == NULL) return SFP_ERR_ALLOC_FAILED;
+
+	SFPFunction_setType(outFunc, SFPFunction_getType(msg));
+	SFPFunction_setID(outFunc, UPER_FID_WAVELOAD);
+	SFPFunction_setName(outFunc, UPER_FNAME_WAVELOAD);
+	SFPFunction_addArgument_int32(outFunc, accepted);	// 0 - both buffers are still queued, retry later
+	SFPFunction_addArgument_int32(outFunc, WaveHandler.running);
+	SFPFunction_send(outFunc, &stream);
+	SFPFunction_delete(outFunc);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_wave_start(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 1)
+		return SFP_ERR_ARG_COUNT;
+
+	if (SFPFunction_getArgumentType(msg, 0) != SFP_ARG_INT)
+		return SFP_ERR_ARG_TYPE;
+
+	WaveHandler.loop = (SFPFunction_getArgument_int32(msg, 0) == 0 ? 0 : 1);
+
+	if (WaveHandler.running)	// Only the loop mode is updated
+		return SFP_OK;
+
+	if (WaveHandler.length[WaveHandler.playBuffer] == 0)
+		WaveHandler.playBuffer ^= 1;
+
+	if (WaveHandler.length[WaveHandler.playBuffer] == 0)	// Nothing loaded
+		return SFP_ERR_ARG_VALUE;
+
+	WaveHandler.position = 0;
+	WaveHandler.running = 1;
+	WaveHandler.nextTime = Time_getAlarmTime();
+	Time_setAlarm(TIME_ALARM_WAVE, WaveHandler.nextTime, WAVE_Play, NULL);
+
+	return SFP_OK;
+}
+
+SFPResult lpc_wave_stop(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 0)
+		return SFP_ERR_ARG_COUNT;
+
+	WAVE_Stop();
+
+	return SFP_OK;
+}
+
+SFPResult lpc_wave_end(SFPFunction *msg) {
+	if (SFPFunction_getArgumentCount(msg) != 0)
+		return SFP_ERR_ARG_COUNT;
+
+	WAVE_Free();
+
+	return SFP_OK;
+}
@@ -40,6 +40,10 @@
 #include "Modules/LPC_I2C.h"
 #include "Modules/LPC_PWM.h"
 #include "Modules/LPC_1WIRE.h"
+#include "Modules/LPC_WAVE.h"
+#include "Modules/LPC_COUNTER.h"
+#include "Modules/LPC_ENCODER.h"
+#include "Modules/LPC_POLL.h"
 
 #include "IAP.h"
 
@@ -83,7 +87,7 @@ int main(void) {
 	// Init the rest of the system
 	Time_init();
 
-	LPC_SYSCON->SYSAHBCLKCTRL |= BIT6 | BIT16 | BIT19; // Enable clock for GPIO, IOConfig and Pin Interrupts
+	LPC_SYSCON->SYSAHBCLKCTRL |= BIT6 | BIT16 | BIT19 | BIT23 | BIT24; // Enable clock for GPIO, IOConfig, Pin and Group Interrupts
 
 #ifndef DEBUG
 	// Disabled for debugging (JTAG)
@@ -108,25 +112,56 @@ int main(void) {
 	SFPServer_addFunctionHandler(server, UPER_FNAME_ATTACHINTERRUPT, UPER_FID_ATTACHINTERRUPT, lpc_attachInterrupt);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_DETACHINTERRUPT, UPER_FID_DETACHINTERRUPT, lpc_detachInterrupt);
 
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ATTACHGROUPINT, UPER_FID_ATTACHGROUPINT, lpc_attachGroupInterrupt);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_DETACHGROUPINT, UPER_FID_DETACHGROUPINT, lpc_detachGroupInterrupt);
+
 	SFPServer_addFunctionHandler(server, UPER_FNAME_PULSEIN, UPER_FID_PULSEIN, lpc_pulseIn);
 
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SHIFTOUT, UPER_FID_SHIFTOUT, lpc_shiftOut);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SHIFTIN, UPER_FID_SHIFTIN, lpc_shiftIn);
+
+	SFPServer_addFunctionHandler(server, UPER_FNAME_COUNTERBEGIN, UPER_FID_COUNTERBEGIN, lpc_counter_begin);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_COUNTERREAD,  UPER_FID_COUNTERREAD,	lpc_counter_read);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_COUNTEREND,   UPER_FID_COUNTEREND,	lpc_counter_end);
+
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ENCODERBEGIN, UPER_FID_ENCODERBEGIN, lpc_encoder_begin);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ENCODERREAD,  UPER_FID_ENCODERREAD,	lpc_encoder_read);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ENCODEREND,   UPER_FID_ENCODEREND,	lpc_encoder_end);
+
 	/* ADC functions */
 	SFPServer_addFunctionHandler(server, UPER_FNAME_ANALOGREAD, UPER_FID_ANALOGREAD, lpc_analogRead);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ADCSTREAMBEGIN, UPER_FID_ADCSTREAMBEGIN, lpc_adc_stream_begin);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ADCTIMEDBEGIN,  UPER_FID_ADCTIMEDBEGIN, lpc_adc_timed_begin);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ADCSTREAMEND,   UPER_FID_ADCSTREAMEND, lpc_adc_stream_end);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ADCCONFIG,      UPER_FID_ADCCONFIG, lpc_adc_config);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ADCFILTER,      UPER_FID_ADCFILTER, lpc_adc_filter);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_ADCWATCH,       UPER_FID_ADCWATCH, lpc_adc_watch);
 
 	/* SPI functions */
 	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI0BEGIN, UPER_FID_SPI0BEGIN, lpc_spi0_begin);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI0TRANS, UPER_FID_SPI0TRANS, lpc_spi0_trans);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI0XFER,  UPER_FID_SPI0XFER, lpc_spi0_xfer);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI0SLAVE, UPER_FID_SPI0SLAVE, lpc_spi0_slave);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI0START, UPER_FID_SPI0START, lpc_spi0_start);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI0END,   UPER_FID_SPI0END, lpc_spi0_end);
 
 	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI1BEGIN, UPER_FID_SPI1BEGIN, lpc_spi1_begin);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI1TRANS, UPER_FID_SPI1TRANS, lpc_spi1_trans);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI1XFER,  UPER_FID_SPI1XFER, lpc_spi1_xfer);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI1SLAVE, UPER_FID_SPI1SLAVE, lpc_spi1_slave);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI1START, UPER_FID_SPI1START, lpc_spi1_start);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_SPI1END,   UPER_FID_SPI1END, lpc_spi1_end);
 
 	/* I2C functions */
 	SFPServer_addFunctionHandler(server, UPER_FNAME_I2CBEGIN, UPER_FID_I2CBEGIN, lpc_i2c_begin);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_I2CTRANS, UPER_FID_I2CTRANS, lpc_i2c_trans);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_I2CBATCH, UPER_FID_I2CBATCH, lpc_i2c_batch);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_I2CEND,   UPER_FID_I2CEND, lpc_i2c_end);
 
+	/* Bus polling functions */
+	SFPServer_addFunctionHandler(server, UPER_FNAME_POLLBEGIN, UPER_FID_POLLBEGIN, lpc_poll_begin);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_POLLEND,   UPER_FID_POLLEND, lpc_poll_end);
+
 	/* PWM functions */
 	SFPServer_addFunctionHandler(server, UPER_FNAME_PWM0BEGIN, UPER_FID_PWM0BEGIN, lpc_pwm0_begin);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_PWM0SET,   UPER_FID_PWM0SET, lpc_pwm0_set);
@@ -136,6 +171,13 @@ int main(void) {
 	SFPServer_addFunctionHandler(server, UPER_FNAME_PWM1SET,   UPER_FID_PWM1SET, lpc_pwm1_set);
 	SFPServer_addFunctionHandler(server, UPER_FNAME_PWM1END,   UPER_FID_PWM1END, lpc_pwm1_end);
 
+	/* Waveform functions */
+	SFPServer_addFunctionHandler(server, UPER_FNAME_WAVEBEGIN, UPER_FID_WAVEBEGIN, lpc_wave_begin);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_WAVELOAD,  UPER_FID_WAVELOAD, lpc_wave_load);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_WAVESTART, UPER_FID_WAVESTART, lpc_wave_start);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_WAVESTOP,  UPER_FID_WAVESTOP, lpc_wave_stop);
+	SFPServer_addFunctionHandler(server, UPER_FNAME_WAVEEND,   UPER_FID_WAVEEND, lpc_wave_end);
+
 
 	/* Other functions */
 	SFPServer_addFunctionHandler(server, "wire_begin", 100, lpc_1wire_begin);
@@ -145,9 +187,15 @@ int main(void) {
 	SFPServer_addFunctionHandler(server, UPER_FNAME_GETDEVICEINFO,  UPER_FID_GETDEVICEINFO, lpc_system_getDeviceInfo);
 
 
-	SFPServer_loop(server);
-
-	SFPServer_delete(server);
+	while (1) {
+		SFPServer_cycle(server);	// Serve incoming function calls
 
-	while (1);
+		/* Background tasks */
+		GPIO_Process();
+		COUNTER_Process();
+		ENCODER_Process();
+		ADC_Process();
+		SPI_Process();
+		POLL_Process();
+	}
 }
@@ -46,6 +46,14 @@ typedef struct {
 
 volatile Timer_t time_timers[TIMER_COUNT];
 
+typedef struct {
+	TimerCallback callback;
+	void* callbackParam;
+} Alarm_t;
+
+volatile Alarm_t time_alarms[TIME_ALARM_COUNT];
+volatile uint32_t time_alarmsPending;	// Alarms set in the past, fired by software
+
 volatile time_t timer_delay;
 volatile time_t timer_countdown;
 
@@ -78,6 +86,18 @@ void Time_init(void) {
 
 	SysTick_Config(SystemCoreClock/1000);	// Configure Systick to run at 1kHz (1ms)
 	NVIC_SetPriority(SysTick_IRQn, 0);
+
+	time_alarmsPending = 0;
+
+	LPC_SYSCON->SYSAHBCLKCTRL |= BIT10;	// enable clock for CT32B1
+	LPC_CT32B1->TCR = BIT0 | BIT1;	// Enable timer, but keep in reset state
+	LPC_CT32B1->PR = 48-1;	// 48MHz/48 = 1MHz (1us)
+	LPC_CT32B1->MCR = 0;	// No match interrupts, free running
+	LPC_CT32B1->IR = 0xF;	// Clear match flags
+	LPC_CT32B1->TCR &= ~BIT1;	// disable reset
+
+	NVIC_SetPriority(TIMER_32_1_IRQn, 1);
+	NVIC_EnableIRQ(TIMER_32_1_IRQn);
 }
 
 time_t Time_getSystemTime(void) {
@@ -121,3 +141,52 @@ uint8_t Time_isCountdownRunning(void) {
 
 	return 1;
 }
+
+void TIMER32_1_IRQHandler(void) {
+	__disable_irq();
+	uint32_t flags = (LPC_CT32B1->IR & 0xF) | time_alarmsPending;
+	LPC_CT32B1->IR = flags & 0xF;	// Clear match flags
+	time_alarmsPending = 0;
+	__enable_irq();
+
+	uint8_t i;
+	for (i=0; i<TIME_ALARM_COUNT; i++) {
+		if ((flags & (1 << i)) == 0)
+			continue;
+
+		__disable_irq();
+		uint32_t enabled = LPC_CT32B1->MCR & (1 << (i*3));
+		LPC_CT32B1->MCR &= ~(1 << (i*3));	// Alarms are one-shot
+		__enable_irq();
+
+		if (enabled)
+			time_alarms[i].callback(time_alarms[i].callbackParam);
+	}
+}
+
+time_us_t Time_getAlarmTime(void) {
+	return LPC_CT32B1->TC;
+}
+
+void Time_setAlarm(uint8_t alarm, time_us_t time, TimerCallback callback, void *param) {
+	__disable_irq();
+	time_alarms[alarm].callback = callback;
+	time_alarms[alarm].callbackParam = param;
+
+	LPC_CT32B1->MR[alarm] = time;
+	LPC_CT32B1->IR = (1 << alarm);	// Drop match flag of the previous alarm time
+	LPC_CT32B1->MCR |= (1 << (alarm*3));	// Interrupt on match
+
+	if ((int32_t)(time - LPC_CT32B1->TC) <= 1) {	// Too late for the match hardware, fire from software
+		time_alarmsPending |= (1 << alarm);
+		NVIC_SetPendingIRQ(TIMER_32_1_IRQn);
+	}
+	__enable_irq();
+}
+
+void Time_clearAlarm(uint8_t alarm) {
+	__disable_irq();
+	LPC_CT32B1->MCR &= ~(1 << (alarm*3));
+	time_alarmsPending &= ~(1 << alarm);
+	__enable_irq();
+}
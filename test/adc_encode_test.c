@@ -0,0 +1,294 @@
+/**
+ * @file	adc_encode_test.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Host test of the adc_stream encodings: blocks are decoded the way the host
+ * does it and compared with the encoded samples. The samples per block of both
+ * encodings are printed and checked against the delta encoding's goal.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Modules/ADC_Encode.h"
+
+#define ADC_MAX			1023
+#define RING_SIZE_N		8
+#define RING_MASK		((1 << RING_SIZE_N) - 1)
+#define PACKED_SAMPLES	48		// ADC_STREAM_BATCH
+#define BLOCK_SAMPLES	120		// ADC_STREAM_DELTA_BATCH
+#define BLOCK_BYTES		60		// ADC_STREAM_BLOCK_BYTES
+#define STREAM_SAMPLES	20000
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+/*
+ * Host side decoder
+ */
+typedef struct {
+	const uint8_t *ptr;
+	const uint8_t *end;
+	uint32_t acc;
+	uint8_t bits;
+} BitReader;
+
+static int getBits(BitReader *r, uint8_t bits, uint32_t *value) {	// LSB first
+	while (r->bits < bits) {
+		if (r->ptr == r->end) return 0;
+		r->acc |= (uint32_t)*r->ptr++ << r->bits;
+		r->bits += 8;
+	}
+
+	*value = r->acc & ((1 << bits) - 1);
+	r->acc >>= bits;
+	r->bits -= bits;
+	return 1;
+}
+
+static int decodePacked(const uint8_t *data, uint32_t size, uint32_t count, uint16_t *out) {
+	BitReader r = { data, data + size, 0, 0 };
+	uint32_t i, v;
+
+	for (i=0; i<count; i++) {
+		if (!getBits(&r, 10, &v)) return 0;
+		out[i] = v;
+	}
+
+	return size == (count*10 + 7) / 8;
+}
+
+static int decodeDelta(const uint8_t *data, uint32_t size, uint32_t count, uint8_t channels, uint16_t *out) {
+	BitReader r = { data, data + size, 0, 0 };
+	uint32_t i, v;
+
+	for (i=0; i<count; i++) {
+		if (i < channels) {	// The first sweep is raw
+			if (!getBits(&r, 10, &v)) return 0;
+			out[i] = v;
+			continue;
+		}
+
+		if (!getBits(&r, 4, &v)) return 0;
+		if (v == ADC_DELTA_ESCAPE) {
+			if (!getBits(&r, 10, &v)) return 0;
+			out[i] = v;
+		} else {
+			int32_t delta = (v & 0x8 ? (int32_t)v - 16 : (int32_t)v);
+			int32_t x = out[i - channels] + delta;
+			if (x < 0 || x > ADC_MAX) return 0;
+			out[i] = x;
+		}
+	}
+
+	return r.ptr == r.end && r.bits < 8;	// Only the padding is left
+}
+
+/*
+ * Signal generators
+ */
+static uint16_t clamp(int32_t x) {
+	return (x < 0 ? 0 : (x > ADC_MAX ? ADC_MAX : x));
+}
+
+static void fillWalk(uint16_t *x, uint32_t count, uint8_t channels, int32_t step, uint32_t jumpEvery) {	// A walk per channel
+	int32_t v[8];
+	uint32_t i;
+
+	for (i=0; i<channels; i++)
+		v[i] = ADC_MAX / 2;
+
+	for (i=0; i<count; i++) {
+		int32_t *ch = &v[i % channels];
+
+		if (jumpEvery && (rand() % jumpEvery) == 0)
+			*ch = rand() % (ADC_MAX + 1);
+		else
+			*ch = clamp(*ch + (rand() % (2*step + 1)) - step);
+		x[i] = *ch;
+	}
+}
+
+/*
+ * Streams the samples through a ring the way ADC_SendStream does and checks
+ * that the decoded blocks give them back. Returns the average samples per block.
+ */
+static double roundTrip(const char *name, const uint16_t *x, uint32_t total, uint8_t channels, uint8_t encoding) {
+	static uint16_t ring[RING_MASK + 1], decoded[BLOCK_SAMPLES];
+	uint8_t data[(BLOCK_SAMPLES*ADC_DELTA_MAX_BITS + 7)/8];
+	uint32_t readPos = 5 * (RING_MASK + 1) - 7, writePos = readPos;	// Start near a wrap of the positions
+	uint32_t done = 0, produced = 0, blocks = 0;
+	uint32_t batch = (encoding == ADC_ENCODING_DELTA ? BLOCK_SAMPLES : PACKED_SAMPLES) / channels * channels;
+
+	total -= total % channels;
+	while (done < total) {
+		while (produced < total && writePos - readPos <= RING_MASK) {	// The ISR fills the ring
+			ring[writePos++ & RING_MASK] = x[produced++];
+		}
+
+		uint32_t count = writePos - readPos;
+		if (count > batch) count = batch;
+
+		ADC_BitWriter w = { data, 0, 0 };
+		uint32_t encoded;
+		int ok;
+
+		if (encoding == ADC_ENCODING_DELTA) {
+			encoded = ADC_EncodeDelta(ring, RING_MASK, readPos, count, channels, BLOCK_BYTES, &w);
+			ADC_FlushBits(&w);
+			CHECK(encoded % channels == 0, "%s: block of %u samples splits a sweep", name, encoded);
+			CHECK(encoded > 0, "%s: empty block", name);
+			ok = decodeDelta(data, w.ptr - data, encoded, channels, decoded);
+		} else {
+			encoded = ADC_EncodePacked(ring, RING_MASK, readPos, count, &w);
+			ADC_FlushBits(&w);
+			ok = decodePacked(data, w.ptr - data, encoded, decoded);
+		}
+
+		CHECK(ok, "%s: block %u doesn't decode", name, blocks);
+		CHECK(memcmp(decoded, &x[done], encoded * sizeof(uint16_t)) == 0, "%s: block %u differs", name, blocks);
+		if (!ok || encoded == 0) return 0;
+
+		readPos += encoded;
+		done += encoded;
+		blocks++;
+	}
+
+	return (double)done / blocks;
+}
+
+static void testEscapes(void) {
+	// Deltas of +-7 are nibbles, +-8 and beyond escape; the delta after an escape is from the raw value
+	uint16_t x[] = { 500, 507, 500, 492, 484, 1023, 1016, 0, 7, 15, 8, 1023, 1023, 0, 0 };
+	uint16_t ring[16], decoded[16];
+	uint8_t data[32];
+	uint32_t n = sizeof(x) / sizeof(x[0]);
+
+	memcpy(ring, x, sizeof(x));
+	ADC_BitWriter w = { data, 0, 0 };
+	uint32_t encoded = ADC_EncodeDelta(ring, 15, 0, n, 1, sizeof(data), &w);
+	ADC_FlushBits(&w);
+
+	CHECK(encoded == n, "escape block encoded %u of %u samples", encoded, n);
+	// Escaped: 492 (-8), 484 (-8), 1023, 0, 15 (+8), 1023, 0
+	uint32_t escapes = 7;
+	CHECK((uint32_t)(w.ptr - data) == (10 + (n - 1)*4 + escapes*10 + 7) / 8,
+			"escape block takes %u bytes", (uint32_t)(w.ptr - data));
+	CHECK(decodeDelta(data, w.ptr - data, n, 1, decoded), "escape block doesn't decode");
+	CHECK(memcmp(decoded, x, sizeof(x)) == 0, "escape block differs");
+
+	// A nibble of -8 is the escape, never a delta
+	BitReader r = { data, w.ptr, 0, 0 };
+	uint32_t v = 0, i, nibbles = 0;
+	getBits(&r, 10, &v);
+	for (i=1; i<n && getBits(&r, 4, &v); i++) {
+		nibbles++;
+		if (v == ADC_DELTA_ESCAPE) getBits(&r, 10, &v);
+	}
+	CHECK(nibbles == n - 1, "escape block has %u of %u deltas", nibbles, n - 1);
+	CHECK(r.ptr == r.end, "escape block has trailing bytes");
+}
+
+static void testBlockLimit(void) {
+	// Noise escapes every sample: blocks are cut at whole sweeps within the byte budget
+	uint16_t ring[RING_MASK + 1];
+	uint8_t data[(BLOCK_SAMPLES*ADC_DELTA_MAX_BITS + 7)/8];
+	uint8_t channels;
+	uint32_t i;
+
+	for (i=0; i<=RING_MASK; i++)
+		ring[i] = (i & 1 ? ADC_MAX : 0);
+
+	for (channels=1; channels<=8; channels++) {
+		ADC_BitWriter w = { data, 0, 0 };
+		uint32_t count = BLOCK_SAMPLES / channels * channels;
+		uint32_t encoded = ADC_EncodeDelta(ring, RING_MASK, 0, count, channels, BLOCK_BYTES, &w);
+		ADC_FlushBits(&w);
+
+		CHECK(encoded % channels == 0, "%u channels: block splits a sweep", channels);
+		CHECK((uint32_t)(w.ptr - data) <= BLOCK_BYTES, "%u channels: block takes %u > %u bytes",
+				channels, (uint32_t)(w.ptr - data), BLOCK_BYTES);
+	}
+}
+
+/*
+ * Samples per block of both encodings. A slowly changing signal must fit at
+ * least 2x more samples in a delta block; on noise the escapes cost up to 14
+ * bits a sample, so a delta block must still hold what fits at that rate.
+ */
+static void benchmark(const char *name, const uint16_t *x, uint8_t channels, uint8_t quiet) {
+	double packed = roundTrip(name, x, STREAM_SAMPLES, channels, ADC_ENCODING_PACKED);
+	double delta = roundTrip(name, x, STREAM_SAMPLES, channels, ADC_ENCODING_DELTA);
+	uint32_t worst = (BLOCK_BYTES*8 - channels*10) / ADC_DELTA_MAX_BITS / channels * channels + channels;
+
+	printf("  %-30s packed %5.1f  delta %5.1f  (%.2fx)\n", name, packed, delta, delta / packed);
+
+	if (quiet)
+		CHECK(delta >= 2*packed, "%s: %.1f delta samples per block, %.1f packed", name, delta, packed);
+	else
+		CHECK(delta >= worst, "%s: %.1f delta samples per block, worst case %u", name, delta, worst);
+}
+
+int main(void) {
+	static uint16_t x[STREAM_SAMPLES];
+	char name[64];
+	uint8_t channels;
+
+	srand(1);
+
+	testEscapes();
+	testBlockLimit();
+
+	printf("adc_encode_test: samples per %u byte block\n", BLOCK_BYTES);
+	for (channels=1; channels<=8; channels++) {
+		fillWalk(x, STREAM_SAMPLES, channels, 3, 0);
+		sprintf(name, "quiet, %u channels", channels);
+		benchmark(name, x, channels, 1);
+
+		fillWalk(x, STREAM_SAMPLES, channels, 12, 20);
+		sprintf(name, "noisy with jumps, %u channels", channels);
+		benchmark(name, x, channels, 0);
+	}
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("adc_encode_test: OK\n");
+
+	return failures != 0;
+}
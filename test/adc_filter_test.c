@@ -0,0 +1,243 @@
+/**
+ * @file	adc_filter_test.c
+ * @author  Giedrius Medzevicius <giedrius@8devices.com>
+ *
+ * @section LICENSE
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013 UAB 8devices
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Host test of the analogRead filters against a floating point reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "Modules/ADC_Filter.h"
+
+#define ADC_MAX		1023
+#define RUNS		200
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			failures++; \
+		} \
+	} while (0)
+
+static uint16_t randomSample(void) {
+	return rand() % (ADC_MAX + 1);
+}
+
+/*
+ * Runs a single read the way ADC_ReadChannels does
+ */
+static uint16_t filterRead(ADC_Filter *f, const uint16_t *x, uint32_t count) {
+	uint32_t i;
+
+	ADC_FilterReset(f);
+	for (i=0; i<count; i++)
+		ADC_FilterPut(f, x[i], i);
+
+	return ADC_FilterResult(f);
+}
+
+static void setup(ADC_Filter *f, uint8_t type, uint8_t shift, uint8_t order) {
+	f->type = type;
+	f->shift = shift;
+	f->order = order;
+	f->primed = 0;
+	f->state = 0;
+}
+
+static void testOversample(void) {
+	uint16_t x[1 << 8];
+	ADC_Filter f;
+	uint8_t n;
+	int run;
+
+	for (n=1; n<=4; n++) {
+		setup(&f, ADC_FILTER_OVERSAMPLE, n, 0);
+		uint32_t count = ADC_FilterSamples(&f);
+		CHECK(count == (1u << (2*n)), "oversample n=%u takes %u samples", n, count);
+
+		for (run=0; run<RUNS; run++) {
+			double sum = 0;
+			uint32_t i;
+			for (i=0; i<count; i++) {
+				x[i] = (run == 0 ? ADC_MAX : randomSample());	// Full scale first
+				sum += x[i];
+			}
+
+			uint16_t ref = floor(sum / (1 << n));	// 10+n bits, truncated
+			uint16_t y = filterRead(&f, x, count);
+			CHECK(y == ref, "oversample n=%u: %u != %u", n, y, ref);
+			CHECK(y < (1u << (10 + n)), "oversample n=%u: %u out of range", n, y);
+		}
+	}
+}
+
+static void testAverage(void) {
+	uint16_t x[1 << 8];
+	ADC_Filter f;
+	uint8_t n;
+	int run;
+
+	for (n=0; n<=8; n++) {
+		setup(&f, ADC_FILTER_AVERAGE, n, 0);
+		uint32_t count = ADC_FilterSamples(&f);
+
+		for (run=0; run<RUNS; run++) {
+			double sum = 0;
+			uint32_t i;
+			for (i=0; i<count; i++) {
+				x[i] = randomSample();
+				sum += x[i];
+			}
+
+			uint16_t ref = floor(sum / count + 0.5);	// Halves round up
+			uint16_t y = filterRead(&f, x, count);
+			CHECK(y == ref, "average n=%u: %u != %u", n, y, ref);
+		}
+	}
+
+	// Exact halves
+	uint16_t half[2] = { 1, 2 };
+	setup(&f, ADC_FILTER_AVERAGE, 1, 0);
+	CHECK(filterRead(&f, half, 2) == 2, "average of 1, 2 rounds up");
+
+	uint16_t top[2] = { ADC_MAX, ADC_MAX - 1 };
+	CHECK(filterRead(&f, top, 2) == ADC_MAX, "average of 1023, 1022 rounds up");
+}
+
+static void testIIR(void) {
+	ADC_Filter f;
+	uint8_t n;
+	int run;
+
+	for (n=1; n<=8; n++) {
+		setup(&f, ADC_FILTER_IIR, n, 0);
+		CHECK(ADC_FilterSamples(&f) == 1, "IIR takes one sample per read");
+
+		// Truncating y by up to 2^-ADC_IIR_FRACTION_BITS per step biases it by up to 2^n times that
+		double tolerance = (double)(1 << n) / (1 << ADC_IIR_FRACTION_BITS) + 0.5;
+		double ref = 0;
+
+		for (run=0; run<RUNS + (16 << n); run++) {
+			uint16_t x = (run < RUNS ? randomSample() : ADC_MAX);	// Settles at full scale
+			uint16_t y = filterRead(&f, &x, 1);
+
+			if (run == 0)
+				ref = x;
+			else
+				ref += (x - ref) / (1 << n);
+
+			CHECK(fabs(y - ref) <= tolerance, "IIR n=%u step %d: %u vs %.3f", n, run, y, ref);
+		}
+
+		CHECK(fabs((double)ADC_FilterResult(&f) - ADC_MAX) <= tolerance, "IIR n=%u doesn't settle at full scale", n);
+	}
+
+	// The first read primes the output
+	uint16_t x = 500;
+	setup(&f, ADC_FILTER_IIR, 4, 0);
+	CHECK(filterRead(&f, &x, 1) == 500, "IIR isn't primed by the first read");
+}
+
+/*
+ * CIC reference: m cascaded moving sums of R = 2^n samples, taken at the last
+ * input and divided by the gain R^m.
+ */
+static double cicReference(const uint16_t *x, uint32_t count, uint8_t order, uint32_t R) {
+	static double stage[2][1024];
+	uint32_t i, k, s;
+
+	for (i=0; i<count; i++)
+		stage[0][i] = x[i];
+
+	for (s=0; s<order; s++) {
+		double *in = stage[s & 1], *out = stage[(s + 1) & 1];
+		for (i=0; i<count; i++) {
+			out[i] = 0;
+			for (k=0; k<R && k<=i; k++)
+				out[i] += in[i - k];
+		}
+	}
+
+	return stage[order & 1][count - 1] / pow(R, order);
+}
+
+static void testCIC(void) {
+	uint16_t x[1024];
+	ADC_Filter f;
+	uint8_t m, n;
+	int run;
+
+	for (m=1; m<=ADC_CIC_MAX_ORDER; m++) {
+		for (n=1; n<=6; n++) {
+			setup(&f, ADC_FILTER_CIC, n, m);
+			uint32_t count = ADC_FilterSamples(&f);
+			CHECK(count == (uint32_t)m << n, "CIC m=%u n=%u takes %u samples", m, n, count);
+
+			for (run=0; run<RUNS/4; run++) {
+				uint32_t i;
+				for (i=0; i<count; i++)
+					x[i] = (run == 0 ? ADC_MAX : randomSample());	// Full scale first: max. gain
+
+				uint16_t ref = floor(cicReference(x, count, m, 1 << n));
+				uint16_t y = filterRead(&f, x, count);
+				CHECK(y == ref, "CIC m=%u n=%u: %u != %u", m, n, y, ref);
+			}
+		}
+	}
+
+	// Max. order and decimation: the output takes 10+3*6 = 28 bits and the integrators wrap many times
+	setup(&f, ADC_FILTER_CIC, 6, ADC_CIC_MAX_ORDER);
+	ADC_FilterReset(&f);
+	uint32_t i;
+	for (i=0; i<1000000; i++)
+		ADC_FilterPut(&f, ADC_MAX, i);
+	CHECK(ADC_FilterResult(&f) == ADC_MAX, "CIC full scale after integrator wrap: %u", ADC_FilterResult(&f));
+}
+
+int main(void) {
+	srand(1);
+
+	testOversample();
+	testAverage();
+	testIIR();
+	testCIC();
+
+	if (failures)
+		printf("%d failures\n", failures);
+	else
+		printf("adc_filter_test: OK\n");
+
+	return failures != 0;
+}